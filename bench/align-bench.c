@@ -0,0 +1,100 @@
+/******************************************************************************************************
+ * align-bench: aligned allocation against aligning by hand                                           *
+ *                                                                                                    *
+ * For alignments from 64 bytes to 4 KiB, allocate COUNT blocks of 16-1024 bytes, free every other    *
+ * one and allocate them again, both                                                                  *
+ * 1. with mm_posix_memalign, which gives the leading slack back to the heap                          *
+ * 2. by hand: mm_malloc(size + align - 1 + sizeof(void *)), rounding the pointer up and keeping the  *
+ *    block in the word before it                                                                     *
+ * and report the time and the heap it took. Then check that alignments from 2^32 to 2^63 fail with   *
+ * ENOMEM, exiting with 1 if they do not (mem_sbrk may report the heap growths it refused).           *
+ *                                                                                                    *
+ * Build it with the stand-ins in bench/ (or the lab's memlib.c and mm.h), e.g.                       *
+ *	gcc -O2 -DDRIVER -I. -Ibench "malloc V4.c" bench/memlib.c bench/align-bench.c -lpthread       *
+ * and run it as align-bench [COUNT], default 100000.                                                 *
+ ******************************************************************************************************/
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "mm_ext.h"
+
+static double now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *by_hand(size_t align, size_t size){
+	char *p = mm_malloc(size + align - 1 + sizeof(void *));
+	char *q;
+
+	if(p == NULL)
+		return NULL;
+	q = (char *)(((size_t)p + sizeof(void *) + align - 1) & ~(align - 1));
+	((void **)q)[-1] = p;
+	return q;
+}
+
+static void *aligned(size_t align, size_t size){
+	void *p;
+
+	return (mm_posix_memalign(&p, align, size) == 0)? p : NULL;
+}
+
+static int huge_aligns(void){
+	int shift, fails = 0;
+	void *p;
+
+	for(shift = 32; shift < 64; shift++){
+		p = NULL;
+		if(mm_posix_memalign(&p, (size_t)1 << shift, 16) != ENOMEM || p != NULL)
+			fails++;
+		if(mm_posix_memalign(&p, (size_t)1 << shift, 0) != ENOMEM || p != NULL)
+			fails++;
+	}
+	printf("huge alignments: %s\n", (fails == 0)? "ENOMEM" : "FAILED");
+	return fails != 0;
+}
+
+int main(int argc, char **argv){
+	int count = (argc > 1)? atoi(argv[1]) : 100000;
+	void **blocks = malloc(count * sizeof(void *));
+	size_t *sizes = malloc(count * sizeof(size_t));
+	size_t align;
+	mm_stats_t st;
+	double t;
+	int way, i;
+
+	mem_init();
+	printf("%-6s %-10s %10s %12s %12s\n", "align", "", "time", "heap", "live");
+	for(align = 64; align <= 4096; align <<= 1)
+		for(way = 0; way < 2; way++){
+			size_t live = 0;
+
+			srand(1);
+			mem_reset_brk();
+			mm_init();
+			t = now();
+			for(i = 0; i < count; i++){
+				sizes[i] = 16 + rand() % 1009;
+				blocks[i] = (way == 0)? aligned(align, sizes[i]) : by_hand(align, sizes[i]);
+			}
+			for(i = 0; i < count; i += 2)
+				mm_free((way == 0)? blocks[i] : ((void **)blocks[i])[-1]);
+			for(i = 0; i < count; i += 2)
+				blocks[i] = (way == 0)? aligned(align, sizes[i]) : by_hand(align, sizes[i]);
+			t = now() - t;
+			for(i = 0; i < count; i++)
+				live += sizes[i];
+			mm_stats(&st);
+			printf("%-6lu %-10s %7.2f ms %8.2f MiB %8.2f MiB\n", (unsigned long)align,
+				(way == 0)? "memalign" : "by hand", t * 1e3, st.heap_bytes / 1048576.0, live / 1048576.0);
+		}
+	free(sizes);
+	free(blocks);
+	return huge_aligns();
+}
@@ -0,0 +1,135 @@
+/******************************************************************************************************
+ * batch-bench: mm_malloc_batch and mm_free_batch against one call per block                          *
+ *                                                                                                    *
+ * For a few block sizes, ROUNDS times: allocate a batch of N blocks, write a word into each, free    *
+ * them in a shuffled order. Each round runs with n single calls and with one batch call each way,    *
+ * and the time per block of each side is reported. 64 bytes is a small object (thread cache and      *
+ * slabs), the others are heap blocks. Automatic trimming is off, otherwise every round would give    *
+ * the heap back and fault it in again.                                                               *
+ * Last, a checked run: blocks of random sizes are freed by mm_free_batch in random subsets while the *
+ * sampled heap checker (mm_set_check) looks at the heap every few calls. Any error it reports fails  *
+ * the bench.                                                                                         *
+ *                                                                                                    *
+ * Build it with the stand-ins in bench/ (or the lab's memlib.c and mm.h), e.g.                       *
+ *	gcc -O2 -DDRIVER -I. -Ibench "malloc V4.c" bench/memlib.c bench/batch-bench.c -lpthread       *
+ * and run it as batch-bench [N [ROUNDS]], default 1000 and 2000.                                     *
+ ******************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "mm_ext.h"
+
+static int check_errors;
+
+static double now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void check_fail(int err, void *bp){
+	if(check_errors++ == 0)
+		fprintf(stderr, "sampled checker: error %d at %p\n", err, bp);
+}
+
+/*********************************************************
+ * checked - mm_free_batch of random subsets of blocks   *
+ * of random sizes under the sampled checker, return the *
+ * errors it found                                       *
+ *********************************************************/
+static int checked(void **ptrs, size_t n, int rounds){
+	size_t i, k, live = 0;
+	int r;
+
+	srand(2);
+	mem_reset_brk();
+	mm_init();
+	mm_set_check(3, 64, check_fail);
+	for(r = 0; r < rounds; r++){
+		for(; live < n; live++)
+			ptrs[live] = mm_malloc(16 + rand() % 2000);
+		for(i = k = 0; i < live; i++){	//about half of them, neighbours often among them
+			void *p = ptrs[i];
+			if(rand() % 2){
+				ptrs[i] = ptrs[k];
+				ptrs[k++] = p;
+			}
+		}
+		mm_free_batch(ptrs, k);
+		for(i = 0; i < live - k; i++)
+			ptrs[i] = ptrs[k + i];
+		live -= k;
+	}
+	mm_free_batch(ptrs, live);
+	mm_set_check(0, 0, NULL);
+	return check_errors;
+}
+
+int main(int argc, char **argv){
+	size_t n = (argc > 1)? (size_t)atoi(argv[1]) : 1000;
+	int rounds = (argc > 2)? atoi(argv[2]) : 2000;
+	static const size_t sizes[] = {64, 300, 1000, 4000};
+	void **ptrs = malloc(n * sizeof(void *));
+	size_t *order = malloc(n * sizeof(size_t));
+	double t[2][2];	//[single, batch][malloc, free]
+	size_t s, i;
+	int way, r;
+
+	mem_init();
+	mm_set_trim_threshold(0);
+	printf("%-6s %14s %14s %14s %14s\n", "size", "malloc", "malloc_batch", "free", "free_batch");
+	for(s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+		for(way = 0; way < 2; way++){
+			srand(1);
+			mem_reset_brk();
+			mm_init();
+			t[way][0] = t[way][1] = 0;
+			for(r = 0; r < rounds; r++){
+				double t0 = now();
+				if(way == 0)
+					for(i = 0; i < n; i++)
+						ptrs[i] = mm_malloc(sizes[s]);
+				else if(mm_malloc_batch(sizes[s], n, ptrs) != n){
+					fprintf(stderr, "out of memory\n");
+					return 1;
+				}
+				t[way][0] += now() - t0;
+
+				for(i = 0; i < n; i++){	//touch them, then shuffle
+					size_t k = rand() % (i + 1);
+					*(size_t *)ptrs[i] = i;
+					order[i] = order[k];
+					order[k] = i;
+				}
+				for(i = 0; i < n; i++){
+					void *p = ptrs[i];
+					ptrs[i] = ptrs[order[i]];
+					ptrs[order[i]] = p;
+				}
+
+				t0 = now();
+				if(way == 0)
+					for(i = 0; i < n; i++)
+						mm_free(ptrs[i]);
+				else
+					mm_free_batch(ptrs, n);
+				t[way][1] += now() - t0;
+			}
+		}
+		printf("%-6lu", (unsigned long)sizes[s]);
+		for(i = 0; i < 2; i++)
+			printf(" %11.1f ns %11.1f ns", t[0][i] * 1e9 / (n * rounds), t[1][i] * 1e9 / (n * rounds));
+		printf("\n");
+	}
+	if(checked(ptrs, n, 200) != 0){
+		fprintf(stderr, "sampled checker: %d errors\n", check_errors);
+		return 1;
+	}
+	printf("sampled checker: no errors\n");
+	free(order);
+	free(ptrs);
+	return 0;
+}
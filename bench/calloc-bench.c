@@ -0,0 +1,64 @@
+/******************************************************************************************************
+ * calloc-bench: cost of large zeroed allocations                                                     *
+ *                                                                                                    *
+ * Allocates COUNT buffers of SIZE bytes (arguments, default 16 x 1 MiB) three times over:            *
+ * 1. calloc, fresh: every block comes straight from extend_heap and is known to be zero              *
+ * 2. malloc + memset, fresh: what calloc used to cost, on memory never touched before either         *
+ * 3. calloc, reused: the buffers of 1 were written to and freed, their blocks are dirty now          *
+ * memlib's MAX_HEAP has to hold 2 x COUNT x SIZE bytes.                                              *
+ *                                                                                                    *
+ * Build it with the stand-ins in bench/ (or the lab's memlib.c and mm.h), e.g.                       *
+ *	gcc -O2 -DDRIVER -Ibench "malloc V4.c" bench/memlib.c bench/calloc-bench.c -lpthread          *
+ ******************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+static double now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv){
+	int count = (argc > 1)? atoi(argv[1]) : 16;
+	size_t size = (argc > 2)? (size_t)atol(argv[2]) : (1 << 20);
+	void **bufs = malloc(count * sizeof(void *));
+	void **more = malloc(count * sizeof(void *));
+	double t;
+	int i;
+
+	mem_init();
+	printf("%d buffers of %lu bytes\n", count, (unsigned long)size);
+
+	mem_reset_brk();
+	mm_init();
+	t = now();
+	for(i = 0; i < count; i++)
+		bufs[i] = mm_calloc(1, size);
+	printf("%-26s %10.3f ms\n", "calloc, fresh", (now() - t) * 1e3);
+	for(i = 0; i < count; i++)
+		memset(bufs[i], 1, size);
+
+	t = now();
+	for(i = 0; i < count; i++){
+		more[i] = mm_malloc(size);
+		memset(more[i], 0, size);
+	}
+	printf("%-26s %10.3f ms\n", "malloc + memset, fresh", (now() - t) * 1e3);
+
+	for(i = 0; i < count; i++)
+		mm_free(bufs[i]);
+	t = now();
+	for(i = 0; i < count; i++)
+		bufs[i] = mm_calloc(1, size);
+	printf("%-26s %10.3f ms\n", "calloc, reused", (now() - t) * 1e3);
+
+	free(more);
+	free(bufs);
+	return 0;
+}
@@ -0,0 +1,150 @@
+/******************************************************************************************************
+ * container-bench: standard containers on mm_heap.hpp against std::allocator                         *
+ *                                                                                                    *
+ * ROUNDS times, each workload builds its containers and lets them go:                                *
+ * 1. vectors: N/16 std::vector<int>, each grown by push_back to 1-64 elements                        *
+ * 2. unordered_map: N random int keys inserted, half of them erased, every key looked up             *
+ * 3. map: the same on std::map                                                                       *
+ * with the allocators                                                                                *
+ * a. std::allocator (the system malloc)                                                              *
+ * b. mm::Allocator on a Heap<BestFit>, on a Heap<SizeClassFit> and on a Heap<Monotonic> that is      *
+ *    reset after each round instead of freeing                                                       *
+ * c. std::pmr containers on an mm::Resource of a Heap<BestFit>                                       *
+ * and the time per round is reported.                                                                *
+ *                                                                                                    *
+ * Build it with the stand-ins in bench/ (or the lab's memlib.c and mm.h), e.g.                       *
+ *	gcc -O2 -DDRIVER -I. -Ibench -c "malloc V4.c" bench/memlib.c                                  *
+ *	g++ -std=c++17 -O2 -I. -Ibench bench/container-bench.cpp *.o -lpthread                        *
+ * and run it as container-bench [N [ROUNDS]], default 100000 and 20.                                 *
+ ******************************************************************************************************/
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+extern "C"{
+#include "mm.h"
+#include "memlib.h"
+}
+#include "mm_heap.hpp"
+
+template<class A, class T>
+using rebind_t = typename std::allocator_traits<A>::template rebind_alloc<T>;
+
+static double now(){
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template<class A>
+static long vectors(const A &a, int n){
+	using V = std::vector<int, rebind_t<A, int>>;
+	std::vector<V, rebind_t<A, V>> vs{rebind_t<A, V>(a)};
+	std::mt19937 rng(1);
+	long sum = 0;
+
+	for(int i = 0; i < n / 16; i++){
+		vs.push_back(V(rebind_t<A, int>(a)));
+		for(int k = rng() % 64; k >= 0; k--)
+			vs.back().push_back(k);
+	}
+	for(const V &v : vs)
+		sum += v.size();
+	return sum;
+}
+
+template<class A>
+static long unordered(const A &a, int n){
+	using P = std::pair<const int, int>;
+	std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, rebind_t<A, P>> m{rebind_t<A, P>(a)};
+	std::mt19937 rng(1);
+	long found = 0;
+
+	for(int i = 0; i < n; i++)
+		m[rng() % (4 * n)] = i;
+	rng.seed(1);
+	for(int i = 0; i < n; i += 2, rng())
+		m.erase(rng() % (4 * n));
+	rng.seed(1);
+	for(int i = 0; i < n; i++)
+		found += m.count(rng() % (4 * n));
+	return found;
+}
+
+template<class A>
+static long ordered(const A &a, int n){
+	using P = std::pair<const int, int>;
+	std::map<int, int, std::less<int>, rebind_t<A, P>> m{rebind_t<A, P>(a)};
+	std::mt19937 rng(1);
+	long found = 0;
+
+	for(int i = 0; i < n; i++)
+		m[rng() % (4 * n)] = i;
+	rng.seed(1);
+	for(int i = 0; i < n; i += 2, rng())
+		m.erase(rng() % (4 * n));
+	rng.seed(1);
+	for(int i = 0; i < n; i++)
+		found += m.count(rng() % (4 * n));
+	return found;
+}
+
+//runs the workloads with allocator a, calling reset after each round
+template<class A, class Reset>
+static void run(const char *name, const A &a, Reset reset, int n, int rounds){
+	double t[3] = {0, 0, 0}, t0;
+	long check = 0;
+
+	for(int r = 0; r < rounds; r++){
+		t0 = now();
+		check += vectors(a, n);
+		reset();
+		t[0] += now() - t0;
+		t0 = now();
+		check += unordered(a, n);
+		reset();
+		t[1] += now() - t0;
+		t0 = now();
+		check += ordered(a, n);
+		reset();
+		t[2] += now() - t0;
+	}
+	std::printf("%-22s", name);
+	for(double x : t)
+		std::printf(" %11.2f ms", x * 1e3 / rounds);
+	std::printf("   %ld\n", check / rounds);
+}
+
+int main(int argc, char **argv){
+	int n = (argc > 1)? std::atoi(argv[1]) : 100000;
+	int rounds = (argc > 2)? std::atoi(argv[2]) : 20;
+	auto none = []{};
+
+	mem_init();
+	mem_reset_brk();
+	mm_init();
+	std::printf("%-22s %14s %14s %14s   %s\n", "", "vectors", "unordered_map", "map", "check");
+	run("std::allocator", std::allocator<char>(), none, n, rounds);
+	{
+		mm::Heap<mm::BestFit> heap;
+		run("mm, BestFit", mm::Allocator<char, decltype(heap)>(heap), none, n, rounds);
+	}
+	{
+		mm::Heap<mm::SizeClassFit> heap;
+		run("mm, SizeClassFit", mm::Allocator<char, decltype(heap)>(heap), none, n, rounds);
+	}
+	{
+		mm::Heap<mm::Monotonic, 8, mm::ChunkGrowth<(1 << 20)>> heap;
+		run("mm, Monotonic + reset", mm::Allocator<char, decltype(heap)>(heap), [&]{ heap.reset(); }, n, rounds);
+	}
+	{
+		mm::Heap<mm::BestFit> heap;
+		mm::Resource<decltype(heap)> res(heap);
+		run("pmr, BestFit", std::pmr::polymorphic_allocator<char>(&res), none, n, rounds);
+	}
+	return 0;
+}
@@ -0,0 +1,106 @@
+/******************************************************************************************************
+ * fork-bench: fork of a process whose threads allocate, with the allocator built as the library      *
+ *                                                                                                    *
+ * THREADS threads malloc and free small objects without a pause while the main thread forks ROUNDS   *
+ * times. Every child creates a thread that mallocs, frees and exits, then reads mm_stats and exits;  *
+ * the parent waits for it. Reported is the time per fork, the child's run included. A child that is  *
+ * not done in CHILD_SECONDS (a lock still held, a list of mm_stats gone wrong) is killed and counted *
+ * as failed, and fork-bench exits with 1 if any failed.                                              *
+ *                                                                                                    *
+ * Build the library (see the Library Build section of "malloc V4.c") and link against it, e.g.       *
+ *	gcc -O2 -fPIC -shared -fno-builtin-malloc -fno-semantic-interposition                         *
+ *		-ftls-model=initial-exec -I. "malloc V4.c" -o libmm.so -lpthread                      *
+ *	gcc -O2 -I. bench/fork-bench.c -o fork-bench -L. -lmm -lpthread                               *
+ * and run it as LD_LIBRARY_PATH=. ./fork-bench [ROUNDS], default 200.                                *
+ ******************************************************************************************************/
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mm_ext.h"
+
+#define THREADS		3
+#define WINDOW		256	//live blocks per thread
+#define CHILD_SECONDS	10	//a child still running after this is taken as hung
+
+static int stop;
+
+static double now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *churn(void *arg){
+	void *window[WINDOW] = {NULL};
+	unsigned int seed = (unsigned int)(size_t)arg;
+	unsigned int i;
+
+	while(!__atomic_load_n(&stop, __ATOMIC_RELAXED)){
+		seed = seed * 1103515245 + 12345;
+		i = (seed >> 8) % WINDOW;
+		free(window[i]);
+		window[i] = malloc(8 + (seed >> 16) % 500);
+	}
+	for(i = 0; i < WINDOW; i++)
+		free(window[i]);
+	return NULL;
+}
+
+/*********************************************************
+ *                        child                          *
+ *********************************************************/
+static void *child_thread(void *arg){
+	void *volatile p = malloc(100);
+
+	free(p);
+	return arg;
+}
+
+static int child(void){
+	mm_stats_t st;
+	pthread_t tid;
+	size_t calls = 0;
+	int i;
+
+	alarm(CHILD_SECONDS);
+	if(pthread_create(&tid, NULL, child_thread, NULL) != 0)
+		return 1;
+	pthread_join(tid, NULL);
+	mm_stats(&st);
+	for(i = 0; i < MM_STAT_CLASSES; i++)
+		calls += st.malloc_calls[i];
+	return calls == 0;
+}
+
+/*********************************************************
+ *                        main                           *
+ *********************************************************/
+int main(int argc, char **argv){
+	int rounds = (argc > 1)? atoi(argv[1]) : 200;
+	pthread_t tid[THREADS];
+	int i, status, failed = 0;
+	double t;
+
+	for(i = 0; i < THREADS; i++)
+		pthread_create(&tid[i], NULL, churn, (void *)(size_t)(i + 1));
+	t = now();
+	for(i = 0; i < rounds; i++){
+		pid_t pid = fork();
+		if(pid == 0)
+			_exit(child());
+		if(pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			failed++;
+	}
+	t = now() - t;
+	__atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+	for(i = 0; i < THREADS; i++)
+		pthread_join(tid[i], NULL);
+
+	printf("%d forks, %d threads allocating: %.1f us per fork, %d children failed\n", rounds, THREADS,
+		t / rounds * 1e6, failed);
+	return failed != 0;
+}
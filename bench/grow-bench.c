@@ -0,0 +1,83 @@
+/******************************************************************************************************
+ * grow-bench: cost of growing the heap                                                               *
+ *                                                                                                    *
+ * Two phases, each run with the old fixed growth (grow cap = CHUNKSIZE, so every growth is 512 bytes *
+ * or the request) and with adaptive growth (default cap):                                            *
+ * 1. startup: mm_init, then the first 1000 small and medium blocks a program allocates               *
+ * 2. ramp-up: keep allocating 300-4096 byte blocks, freeing one in four, until RAMP MiB are live     *
+ * For each: time, heap growths (sbrk calls), heap size and bytes at the top never handed out.        *
+ * memlib's MAX_HEAP has to hold RAMP MiB and a bit more.                                             *
+ *                                                                                                    *
+ * Build it with the stand-ins in bench/ (or the lab's memlib.c and mm.h), e.g.                       *
+ *	gcc -O2 -DDRIVER -I. -Ibench "malloc V4.c" bench/memlib.c bench/grow-bench.c -lpthread        *
+ * and run it as grow-bench [RAMP], default 64.                                                       *
+ ******************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "mm_ext.h"
+
+static double now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(const char *name, double t){
+	mm_growth_t g;
+
+	mm_get_growth(&g);
+	printf("%-18s %10.3f ms %10lu %10.2f MiB %10.1f KiB\n", name, t * 1e3, (unsigned long)g.sbrk_calls,
+		g.heap_bytes / 1048576.0, g.untouched_bytes / 1024.0);
+}
+
+int main(int argc, char **argv){
+	size_t ramp = (size_t)((argc > 1)? atoi(argv[1]) : 64) << 20;
+	const char *names[2] = {"fixed", "adaptive"};
+	char name[32];
+	double t;
+	int policy, i;
+
+	mem_init();
+	printf("%-18s %13s %10s %14s %14s\n", "", "time", "sbrk calls", "heap", "untouched");
+	for(policy = 0; policy < 2; policy++){
+		mm_set_grow_cap((policy == 0)? 512 : 0);
+		srand(1);
+
+		mem_reset_brk();
+		t = now();
+		mm_init();
+		for(i = 0; i < 1000; i++)
+			mm_malloc((i % 4 == 0)? 300 + rand() % 2000 : 1 + rand() % 200);
+		snprintf(name, sizeof(name), "startup, %s", names[policy]);
+		report(name, now() - t);
+
+		mem_reset_brk();
+		t = now();
+		mm_init();
+		size_t live = 0, n = 0, allocs = 0, cap = ramp / 300 + 1;
+		void **blocks = malloc(cap * sizeof(void *));
+		size_t *sizes = malloc(cap * sizeof(size_t));
+		while(live < ramp && n < cap){
+			sizes[n] = 300 + rand() % (4096 - 300);
+			if((blocks[n] = mm_malloc(sizes[n])) == NULL)
+				break;
+			live += sizes[n++];
+			if(++allocs % 4 == 0){	//free one of the live blocks
+				size_t k = rand() % n;
+				mm_free(blocks[k]);
+				live -= sizes[k];
+				blocks[k] = blocks[--n];
+				sizes[k] = sizes[n];
+			}
+		}
+		snprintf(name, sizeof(name), "ramp-up, %s", names[policy]);
+		report(name, now() - t);
+		free(sizes);
+		free(blocks);
+	}
+	return 0;
+}
@@ -0,0 +1,93 @@
+/******************************************************************************************************
+ * heap-bench: per-request heaps with a bulk reset against freeing every object                       *
+ *                                                                                                    *
+ * A request allocates OBJS objects, most of 16-256 bytes and one in eight of 257-4096 bytes, writes  *
+ * into each and grows a few with realloc; then it is done and all of them go. REQS requests run      *
+ * 1. mm: mm_malloc/mm_realloc, then mm_free of every object                                          *
+ * 2. heap, free: mm_heap_malloc/mm_heap_realloc on a heap handle, then mm_heap_free of every object  *
+ * 3. heap, reset: the same, then a single mm_heap_reset                                              *
+ * and the time per request is reported, split into the allocation and the cleanup.                   *
+ *                                                                                                    *
+ * Build it with the stand-ins in bench/ (or the lab's memlib.c and mm.h), e.g.                       *
+ *	gcc -O2 -DDRIVER -I. -Ibench "malloc V4.c" bench/memlib.c bench/heap-bench.c -lpthread        *
+ * and run it as heap-bench [OBJS [REQS]], default 1000 and 10000.                                    *
+ ******************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "mm_ext.h"
+
+static mm_heap_t *heap;	//NULL: mm_malloc and friends
+
+static double now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *obj_malloc(size_t size){
+	return (heap != NULL)? mm_heap_malloc(heap, size) : mm_malloc(size);
+}
+
+static void *obj_realloc(void *p, size_t size){
+	return (heap != NULL)? mm_heap_realloc(heap, p, size) : mm_realloc(p, size);
+}
+
+int main(int argc, char **argv){
+	int objs = (argc > 1)? atoi(argv[1]) : 1000;
+	int reqs = (argc > 2)? atoi(argv[2]) : 10000;
+	const char *names[3] = {"mm", "heap, free", "heap, reset"};
+	void **ptrs = malloc(objs * sizeof(void *));
+	size_t *sizes = malloc(objs * sizeof(size_t));
+	double t, alloc, cleanup;
+	int way, r, i;
+
+	mem_init();
+	printf("%-12s %14s %14s %14s\n", "", "alloc", "cleanup", "per request");
+	for(way = 0; way < 3; way++){
+		srand(1);
+		mem_reset_brk();
+		mm_init();
+		heap = (way == 0)? NULL : mm_heap_create();
+		alloc = cleanup = 0;
+		for(r = 0; r < reqs; r++){
+			t = now();
+			for(i = 0; i < objs; i++){
+				sizes[i] = (rand() % 8)? 16 + rand() % 241 : 257 + rand() % 3840;
+				if((ptrs[i] = obj_malloc(sizes[i])) == NULL){
+					fprintf(stderr, "out of memory\n");
+					return 1;
+				}
+				memset(ptrs[i], i, 8);
+				if(i % 16 == 15){	//a buffer that grows
+					sizes[i - 8] *= 2;
+					ptrs[i - 8] = obj_realloc(ptrs[i - 8], sizes[i - 8]);
+				}
+			}
+			t = now() - t;
+			alloc += t;
+
+			t = now();
+			if(way == 2)
+				mm_heap_reset(heap);
+			else
+				for(i = 0; i < objs; i++)
+					if(way == 0)
+						mm_free(ptrs[i]);
+					else
+						mm_heap_free(heap, ptrs[i]);
+			cleanup += now() - t;
+		}
+		if(heap != NULL)
+			mm_heap_destroy(heap);
+		printf("%-12s %11.2f us %11.2f us %11.2f us\n", names[way], alloc * 1e6 / reqs,
+			cleanup * 1e6 / reqs, (alloc + cleanup) * 1e6 / reqs);
+	}
+	free(sizes);
+	free(ptrs);
+	return 0;
+}
@@ -0,0 +1,132 @@
+/******************************************************************************************************
+ * index-bench: best fit on a large fragmented heap, with and without the size index                  *
+ *                                                                                                    *
+ * A heap handle is filled up to GIB GiB with blocks of 272 bytes to 256 KiB, 64 sizes to every       *
+ * power of two and the powers equally likely, and every other block is freed, which leaves free      *
+ * blocks of thousands of sizes all over the heap. Then OPS times a random size is allocated and      *
+ * freed again, each a best fit that takes a free block apart and puts it back together. The time     *
+ * per pair is reported, with the cache misses, dTLB load misses and page faults per pair where the   *
+ * kernel lets perf_event_open count them (n/a where it does not, e.g. in most virtual machines).     *
+ * Trimming and the decay are off, the heap stays as it is.                                           *
+ *                                                                                                    *
+ * Build it twice with the stand-ins in bench/ (or the lab's memlib.c and mm.h), once adding          *
+ * -DMM_SIZE_INDEX, and -DMM_SCALED_OFFSETS (or -DMM_WIDE_WORDS) for more than 1 GiB, e.g.            *
+ *	gcc -O2 -DDRIVER -I. -Ibench "malloc V4.c" bench/memlib.c bench/index-bench.c -lpthread       *
+ * and run it as index-bench [GIB [OPS]], default 1 and 1000000.                                      *
+ ******************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "mm_ext.h"
+
+#define COUNTERS	3
+
+static const struct{
+	const char *name;
+	unsigned int type;
+	unsigned long config;
+} counters[COUNTERS] = {
+	{"cache misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+	{"dTLB misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+		| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+	{"page faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+};
+
+static double now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int counter_open(int i){
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = counters[i].type;
+	attr.config = counters[i].config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static size_t random_size(void){	//272 bytes to 256 KiB, 64 sizes to a power of two
+	int shift = 8 + rand() % 10;
+	size_t size = ((size_t)1 << shift) + ((size_t)rand() % 64 << (shift - 6));
+
+	return (size < 272)? 272 : size;
+}
+
+int main(int argc, char **argv){
+	double gib = (argc > 1)? atof(argv[1]) : 1;
+	long ops = (argc > 2)? atol(argv[2]) : 1000000;
+	size_t target = (size_t)(gib * (1 << 30)), total = 0, n = 0, cap = 1 << 16, i;
+	void **blocks = malloc(cap * sizeof(void *));
+	int fd[COUNTERS];
+	long long count;
+	mm_heap_t *heap;
+	mm_stats_t st;
+	double t;
+	long op;
+
+	mem_init();
+	mm_set_trim_threshold(0);
+	mm_set_decay(0);
+	mem_reset_brk();
+	mm_init();
+	if((heap = mm_heap_create()) == NULL){
+		fprintf(stderr, "no heap\n");
+		return 1;
+	}
+	srand(1);
+	t = now();
+	while(total < target){
+		size_t size = random_size();
+		if(n == cap)
+			blocks = realloc(blocks, (cap *= 2) * sizeof(void *));
+		if((blocks[n] = mm_heap_malloc(heap, size)) == NULL)
+			break;	//the reservation of the heap is full
+		total += size;
+		n++;
+	}
+	for(i = 0; i < n; i += 2)
+		mm_heap_free(heap, blocks[i]);
+	mm_stats(&st);
+	printf("%.2f GiB in %lu blocks, %lu of them free, filled in %.2f s\n", total / 1073741824.0,
+		(unsigned long)n, (unsigned long)(n + 1) / 2, now() - t);
+
+	for(i = 0; i < COUNTERS; i++)
+		if((fd[i] = counter_open(i)) != -1)
+			ioctl(fd[i], PERF_EVENT_IOC_ENABLE, 0);
+	t = now();
+	for(op = 0; op < ops; op++){
+		void *p = mm_heap_malloc(heap, random_size());
+		if(p == NULL){
+			fprintf(stderr, "out of memory\n");
+			return 1;
+		}
+		mm_heap_free(heap, p);
+	}
+	t = now() - t;
+	printf("%-14s %10.1f ns\n", "per pair", t * 1e9 / ops);
+	for(i = 0; i < COUNTERS; i++){
+		if(fd[i] == -1 || read(fd[i], &count, sizeof(count)) != sizeof(count)){
+			printf("%-14s %10s\n", counters[i].name, "n/a");
+			continue;
+		}
+		printf("%-14s %10.2f per pair\n", counters[i].name, (double)count / ops);
+		close(fd[i]);
+	}
+	mm_heap_destroy(heap);
+	free(blocks);
+	return 0;
+}
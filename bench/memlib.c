@@ -0,0 +1,77 @@
+/******************************************************************************************************
+ * Stand-in for the malloc lab's memlib.c: a simulated sbrk over one reservation of MAX_HEAP bytes.   *
+ * The handout's version mallocs 20 MiB; this one reserves 1 GiB of address space with mmap and lets  *
+ * the kernel back it on first touch, so large traces and benchmarks fit.                             *
+ ******************************************************************************************************/
+#include <errno.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "memlib.h"
+
+#define MAX_HEAP	((size_t)1 << 30)
+
+static char *mem_start_brk;	//first byte of the heap
+static char *mem_brk;	//last byte of the heap plus one
+static char *mem_max_addr;	//largest legal heap address plus one
+
+/*********************************************************
+ * mem_init - reserve the heap                           *
+ *********************************************************/
+void mem_init(void){
+	mem_start_brk = mmap(NULL, MAX_HEAP, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if(mem_start_brk == MAP_FAILED){
+		fprintf(stderr, "mem_init: mmap failed\n");
+		_exit(1);
+	}
+	mem_brk = mem_start_brk;
+	mem_max_addr = mem_start_brk + MAX_HEAP;
+}
+
+/*********************************************************
+ * mem_deinit - give the heap back                       *
+ *********************************************************/
+void mem_deinit(void){
+	munmap(mem_start_brk, MAX_HEAP);
+}
+
+/*********************************************************
+ * mem_reset_brk - make the heap empty                   *
+ *********************************************************/
+void mem_reset_brk(void){
+	mem_brk = mem_start_brk;
+}
+
+/*********************************************************
+ * mem_sbrk - extend the heap by incr bytes, return the  *
+ * old brk or (void *)-1 when it does not fit            *
+ *********************************************************/
+void *mem_sbrk(int incr){
+	char *old_brk = mem_brk;
+
+	if(incr < 0 || (size_t)incr > (size_t)(mem_max_addr - mem_brk)){
+		errno = ENOMEM;
+		fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+		return (void *)-1;
+	}
+	mem_brk += incr;
+	return old_brk;
+}
+
+void *mem_heap_lo(void){
+	return mem_start_brk;
+}
+
+void *mem_heap_hi(void){
+	return mem_brk - 1;
+}
+
+size_t mem_heapsize(void){
+	return (size_t)(mem_brk - mem_start_brk);
+}
+
+size_t mem_pagesize(void){
+	return (size_t)getpagesize();
+}
@@ -0,0 +1,12 @@
+/******************************************************************************************************
+ * Stand-in for the malloc lab's mm.h, so that the benchmarks build without the handout.              *
+ * The allocator is built with -DDRIVER, which renames malloc, free, realloc and calloc to these.     *
+ ******************************************************************************************************/
+#include <stdio.h>
+
+extern int mm_init(void);
+extern void *mm_malloc(size_t size);
+extern void mm_free(void *ptr);
+extern void *mm_realloc(void *ptr, size_t size);
+extern void *mm_calloc(size_t nmemb, size_t size);
+extern void mm_checkheap(int verbose);
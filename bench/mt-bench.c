@@ -0,0 +1,209 @@
+/******************************************************************************************************
+ * mt-bench: multi-threaded throughput of the allocator                                               *
+ *                                                                                                    *
+ * Two workloads, each run with 1, 2, 4, ... up to N threads (first argument, default 8):            *
+ * 1. churn: every thread mallocs and frees small objects in a private window of live blocks         *
+ * 2. prodcons: half the threads malloc and hand the blocks to the other half through a ring, which   *
+ *	free them, so every free is a free by a thread other than the owner                           *
+ * The time is the wall clock of the whole run; ops/sec counts both malloc and free.                  *
+ * Then a check of threads whose thread-specific destructors malloc and free after the one of the    *
+ * thread cache: no block may be left behind and mm_stats must count every call. It exits with 1 if *
+ * the check fails.                                                                                   *
+ *                                                                                                    *
+ * Build it with the stand-ins in bench/ (or the lab's memlib.c and mm.h), e.g.                       *
+ *	gcc -O2 -DDRIVER -I. -Ibench "malloc V4.c" bench/memlib.c bench/mt-bench.c -lpthread          *
+ ******************************************************************************************************/
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "mm_ext.h"
+
+#define CHURN_OPS	2000000	//malloc + free pairs per thread
+#define CHURN_WINDOW	1024	//live blocks per thread
+#define PC_OPS		1000000	//blocks per producer
+#define RING		4096	//slots per producer/consumer pair
+#define LATE_THREADS	200
+#define LATE_BLOCKS	64	//freed per thread by its destructor
+
+static double now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static unsigned int next_rand(unsigned int *seed){
+	*seed = *seed * 1103515245 + 12345;
+	return *seed >> 8;
+}
+
+/*********************************************************
+ *                        churn                          *
+ *********************************************************/
+static void *churn(void *arg){
+	void *window[CHURN_WINDOW] = {NULL};
+	unsigned int seed = (unsigned int)(size_t)arg;
+	int i;
+
+	for(i = 0; i < CHURN_OPS; i++){
+		unsigned int r = next_rand(&seed);
+		unsigned int slot = r % CHURN_WINDOW;
+		mm_free(window[slot]);
+		window[slot] = mm_malloc(8 + (r >> 12) % 248);
+		*(char *)window[slot] = 1;
+	}
+	for(i = 0; i < CHURN_WINDOW; i++)
+		mm_free(window[i]);
+	return NULL;
+}
+
+/*********************************************************
+ *                       prodcons                        *
+ *********************************************************/
+typedef struct{
+	void *volatile slot[RING];
+	unsigned int seed;
+} ring_t;
+
+static void *producer(void *arg){
+	ring_t *ring = arg;
+	int i;
+
+	for(i = 0; i < PC_OPS; i++){
+		void *bp = mm_malloc(8 + next_rand(&ring->seed) % 248);
+		while(ring->slot[i % RING] != NULL)
+			sched_yield();
+		__atomic_store_n(&ring->slot[i % RING], bp, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+static void *consumer(void *arg){
+	ring_t *ring = arg;
+	int i;
+
+	for(i = 0; i < PC_OPS; i++){
+		void *bp;
+		while((bp = __atomic_load_n(&ring->slot[i % RING], __ATOMIC_ACQUIRE)) == NULL)
+			sched_yield();
+		ring->slot[i % RING] = NULL;
+		mm_free(bp);
+	}
+	return NULL;
+}
+
+/*********************************************************
+ *                      late frees                       *
+ *********************************************************/
+static pthread_key_t late_key;
+
+static void late_destroy(void *arg){
+	void **blocks = arg;
+	int i;
+
+	for(i = 0; i < LATE_BLOCKS; i++){
+		mm_free(blocks[i]);
+		mm_free(mm_malloc(8 + i));
+	}
+	mm_free(blocks);
+}
+
+static void *late_thread(void *arg){
+	void **blocks = mm_malloc(LATE_BLOCKS * sizeof(void *));
+	int i;
+
+	for(i = 0; i < LATE_BLOCKS; i++)
+		blocks[i] = mm_malloc(8 + i);
+	pthread_setspecific(late_key, blocks);
+	return arg;
+}
+
+static size_t sum(const size_t *calls){
+	size_t n = 0;
+	int i;
+
+	for(i = 0; i < MM_STAT_CLASSES; i++)
+		n += calls[i];
+	return n;
+}
+
+static void late_round(void){
+	pthread_t tid;
+	int i;
+
+	for(i = 0; i < LATE_THREADS; i++){
+		pthread_create(&tid, NULL, late_thread, NULL);
+		pthread_join(tid, NULL);
+	}
+}
+
+static int late_frees(void){
+	mm_stats_t before, after;
+
+	mm_free(mm_malloc(1));	//the key of the thread cache comes first, so its destructor runs first
+	pthread_key_create(&late_key, late_destroy);
+	late_round();	//every arena created and its slabs carved
+	mm_stats(&before);
+	late_round();
+	mm_stats(&after);
+	size_t mallocs = sum(after.malloc_calls) - sum(before.malloc_calls);
+	size_t frees = sum(after.free_calls) - sum(before.free_calls);
+	printf("%-10s %8d %12zu %10zu %s\n", "late", LATE_THREADS, mallocs, frees,
+		(after.in_use_bytes > before.in_use_bytes)? "leaked" : "");
+	return mallocs != frees || mallocs != (size_t)LATE_THREADS * (2 * LATE_BLOCKS + 1)
+		|| after.in_use_bytes > before.in_use_bytes;
+}
+
+/*********************************************************
+ *                        main                           *
+ *********************************************************/
+int main(int argc, char **argv){
+	int max_threads = (argc > 1)? atoi(argv[1]) : 8;
+	pthread_t tid[256];
+	int n, i;
+
+	mem_init();
+	if(mm_init() == -1){
+		fprintf(stderr, "mm_init failed\n");
+		return 1;
+	}
+
+	printf("%-10s %8s %12s %10s\n", "workload", "threads", "Mops/sec", "speedup");
+	double base = 0;
+	for(n = 1; n <= max_threads && n <= 256; n *= 2){
+		double t = now();
+		for(i = 0; i < n; i++)
+			pthread_create(&tid[i], NULL, churn, (void *)(size_t)(i + 1));
+		for(i = 0; i < n; i++)
+			pthread_join(tid[i], NULL);
+		double mops = 2.0 * CHURN_OPS * n / (now() - t) / 1e6;
+		if(n == 1)
+			base = mops;
+		printf("%-10s %8d %12.2f %10.2f\n", "churn", n, mops, mops / base);
+	}
+
+	for(n = 2; n <= max_threads && n <= 256; n *= 2){
+		ring_t *rings = calloc(n / 2, sizeof(ring_t));
+		double t = now();
+		for(i = 0; i < n / 2; i++){
+			rings[i].seed = i + 1;
+			pthread_create(&tid[2 * i], NULL, producer, &rings[i]);
+			pthread_create(&tid[2 * i + 1], NULL, consumer, &rings[i]);
+		}
+		for(i = 0; i < n; i++)
+			pthread_join(tid[i], NULL);
+		double mops = 2.0 * PC_OPS * (n / 2) / (now() - t) / 1e6;
+		if(n == 2)
+			base = mops;
+		printf("%-10s %8d %12.2f %10.2f\n", "prodcons", n, mops, mops / base);
+		free(rings);
+	}
+
+	printf("%-10s %8s %12s %10s\n", "check", "threads", "mallocs", "frees");
+	return late_frees();
+}
@@ -0,0 +1,190 @@
+/******************************************************************************************************
+ * pheap-bench: restarting with a persistent heap against rebuilding a cache                          *
+ *                                                                                                    *
+ * The cache is a hash table of N entries, an 8-digit key and a 48-byte value each, whose links are   *
+ * offsets from a base: mm_pheap_base for a persistent heap, NULL (so offsets are pointers) for the   *
+ * memlib heap. Reported:                                                                             *
+ * 1. rebuild: what a process without a persistent heap does on every start, mm_init and N inserts    *
+ * 2. build in file: the same in a fresh persistent heap at PATH, then mm_pheap_close                 *
+ * 3. restart: mm_pheap_open of that file and mm_pheap_root, the cache is there as it was             *
+ * 4. restart after crash: a child opens the heap, adds an entry and dies without closing it, the     *
+ *    next open walks the blocks to rebuild the free tree                                             *
+ * and, after 1 and 3, one lookup of every key (after 3 this is also where the pages fault in).       *
+ *                                                                                                    *
+ * Build it with the stand-ins in bench/ (or the lab's memlib.c and mm.h), e.g.                       *
+ *	gcc -O2 -DDRIVER -I. -Ibench "malloc V4.c" bench/memlib.c bench/pheap-bench.c -lpthread       *
+ * and run it as pheap-bench [N [PATH]], default 1000000 and /tmp/pheap-bench.heap.                   *
+ ******************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "mm_ext.h"
+
+#define KEY_LEN	8
+#define VALUE_LEN	48
+#define AT(base, off)	((void *)((char *)(base) + (off)))
+
+typedef struct{	//the root object
+	size_t table;	//offset of nbuckets offsets, 0 ends a bucket
+	size_t nbuckets;
+	size_t count;
+} cache_t;
+
+typedef struct{
+	size_t next;
+	char key[KEY_LEN];
+	char value[VALUE_LEN];
+} entry_t;
+
+static mm_pheap_t *heap;	//NULL: the memlib heap
+
+static void *cache_malloc(size_t size){
+	return (heap != NULL)? mm_pheap_malloc(heap, size) : mm_malloc(size);
+}
+
+static double now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static size_t hash(const char *key){
+	size_t h = 14695981039346656037ul;
+	int i;
+
+	for(i = 0; i < KEY_LEN; i++)
+		h = (h ^ (unsigned char)key[i]) * 1099511628211ul;
+	return h;
+}
+
+static void make_key(char *key, size_t i){
+	int k;
+
+	for(k = KEY_LEN - 1; k >= 0; k--, i /= 10)
+		key[k] = '0' + i % 10;
+}
+
+static int insert(cache_t *c, char *base, size_t i){
+	entry_t *e = cache_malloc(sizeof(entry_t));
+	size_t *table = AT(base, c->table);
+	size_t b;
+
+	if(e == NULL)
+		return -1;
+	make_key(e->key, i);
+	memset(e->value, 'a' + i % 26, VALUE_LEN);
+	b = hash(e->key) % c->nbuckets;
+	e->next = table[b];
+	table[b] = (char *)e - base;
+	c->count++;
+	return 0;
+}
+
+static cache_t *build(char *base, size_t n){
+	cache_t *c = cache_malloc(sizeof(cache_t));
+	size_t *table, i;
+
+	if(c == NULL || (table = cache_malloc(n * sizeof(size_t))) == NULL)
+		return NULL;
+	memset(table, 0, n * sizeof(size_t));
+	c->table = (char *)table - base;
+	c->nbuckets = n;
+	c->count = 0;
+	for(i = 0; i < n; i++)
+		if(insert(c, base, i) != 0)
+			return NULL;
+	return c;
+}
+
+static size_t lookup_all(const cache_t *c, char *base, size_t n){
+	const size_t *table = AT(base, c->table);
+	char key[KEY_LEN];
+	size_t i, found = 0, off;
+
+	for(i = 0; i < n; i++){
+		make_key(key, i);
+		for(off = table[hash(key) % c->nbuckets]; off != 0; off = ((entry_t *)AT(base, off))->next)
+			if(memcmp(((entry_t *)AT(base, off))->key, key, KEY_LEN) == 0){
+				found += ((entry_t *)AT(base, off))->value[0] == 'a' + i % 26;
+				break;
+			}
+	}
+	return found;
+}
+
+static void report(const char *name, double t, size_t found, size_t n){
+	printf("%-24s %10.2f ms", name, t * 1e3);
+	if(found != (size_t)-1)
+		printf("   %lu of %lu found", (unsigned long)found, (unsigned long)n);
+	printf("\n");
+}
+
+int main(int argc, char **argv){
+	size_t n = (argc > 1)? (size_t)atol(argv[1]) : 1000000;
+	const char *path = (argc > 2)? argv[2] : "/tmp/pheap-bench.heap";
+	size_t size = n * (sizeof(entry_t) + 2 * sizeof(size_t)) * 2 + (1 << 20);	//entries, headers, table, slack
+	cache_t *c;
+	double t;
+	pid_t pid;
+
+	mem_init();
+	mem_reset_brk();
+	mm_init();
+	t = now();
+	if((c = build(NULL, n)) == NULL){
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	report("rebuild", now() - t, -1, n);
+	t = now();
+	size_t found = lookup_all(c, NULL, n);
+	report("lookups, rebuilt", now() - t, found, n);
+
+	unlink(path);
+	t = now();
+	if((heap = mm_pheap_open(path, size)) == NULL || (c = build(mm_pheap_base(heap), n)) == NULL){
+		perror(path);
+		return 1;
+	}
+	mm_pheap_set_root(heap, c);
+	mm_pheap_close(heap);
+	report("build in file", now() - t, -1, n);
+
+	t = now();
+	if((heap = mm_pheap_open(path, 0)) == NULL){
+		perror(path);
+		return 1;
+	}
+	c = mm_pheap_root(heap);
+	report("restart", now() - t, -1, n);
+	t = now();
+	found = lookup_all(c, mm_pheap_base(heap), n);
+	report("lookups, restarted", now() - t, found, n);
+	mm_pheap_close(heap);
+
+	if((pid = fork()) == 0){
+		if((heap = mm_pheap_open(path, 0)) == NULL)
+			_exit(1);
+		insert(mm_pheap_root(heap), mm_pheap_base(heap), n);
+		_exit(0);	//no close: the heap stays marked open
+	}
+	waitpid(pid, NULL, 0);
+	t = now();
+	if((heap = mm_pheap_open(path, 0)) == NULL){
+		perror(path);
+		return 1;
+	}
+	c = mm_pheap_root(heap);
+	report("restart after crash", now() - t, -1, n);
+	found = lookup_all(c, mm_pheap_base(heap), n + 1);
+	printf("%-24s %10s   %lu of %lu found\n", "lookups, after crash", "", (unsigned long)found, (unsigned long)n + 1);
+	mm_pheap_close(heap);
+	unlink(path);
+	return 0;
+}
@@ -0,0 +1,133 @@
+/******************************************************************************************************
+ * prof-bench: the cost of the sampling heap profiler and how well its profile adds up                *
+ *                                                                                                    *
+ * OPS mallocs of 16-4096 bytes from three call sites: one keeps every 16th block for good (a leak),  *
+ * one frees its block at once, one keeps up to 4096 blocks in a ring and frees the oldest. The time  *
+ * per malloc and free pair is reported with the profiler off and at a few rates, then, for the last  *
+ * run, the live and allocated bytes against what the profile at PATH estimates from its samples      *
+ * (scaled as pprof does for heap_v2). Look at the profile with                                       *
+ *	pprof -sample_index=inuse_space a.out PATH                                                    *
+ *                                                                                                    *
+ * Build it with the stand-ins in bench/ (or the lab's memlib.c and mm.h), e.g.                       *
+ *	gcc -O2 -DDRIVER -I. -Ibench "malloc V4.c" bench/memlib.c bench/prof-bench.c -lpthread -lm    *
+ * and run it as prof-bench [OPS [PATH]], default 2000000 and /tmp/prof-bench.heap.                   *
+ ******************************************************************************************************/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "mm_ext.h"
+
+#define RING	4096
+
+static void *ring[RING];
+static size_t ring_sizes[RING];
+static size_t live, allocated;	//bytes, as the bench counts them
+
+static double now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static __attribute__((noinline)) void *leak(size_t size){
+	void *p = mm_malloc(size);
+	live += size;
+	return p;
+}
+
+static __attribute__((noinline)) void transient(size_t size){
+	void *p = mm_malloc(size);
+	*(volatile char *)p = 0;
+	mm_free(p);
+}
+
+static __attribute__((noinline)) void cached(size_t i, size_t size){
+	i %= RING;
+	if(ring[i] != NULL){
+		mm_free(ring[i]);
+		live -= ring_sizes[i];
+	}
+	ring[i] = mm_malloc(size);
+	ring_sizes[i] = size;
+	live += size;
+}
+
+//the estimate of pprof: every line scaled by 1 / (1 - exp(-average size / rate))
+static void estimate(const char *path, double *est_live, double *est_alloc){
+	FILE *f = fopen(path, "r");
+	char line[1024];
+	unsigned long lc, lb, ac, ab, rate = 0;
+
+	*est_live = *est_alloc = 0;
+	if(f == NULL)
+		return;
+	if(fgets(line, sizeof(line), f) != NULL)
+		sscanf(line, "heap profile: %lu: %lu [%lu: %lu] @ heap_v2/%lu", &lc, &lb, &ac, &ab, &rate);
+	while(rate != 0 && fgets(line, sizeof(line), f) != NULL && sscanf(line, "%lu: %lu [%lu: %lu]", &lc, &lb, &ac, &ab) == 4){
+		if(lc != 0)
+			*est_live += lb / (1 - exp(-(double)lb / lc / rate));
+		if(ac != 0)
+			*est_alloc += ab / (1 - exp(-(double)ab / ac / rate));
+	}
+	fclose(f);
+}
+
+int main(int argc, char **argv){
+	long ops = (argc > 1)? atol(argv[1]) : 2000000;
+	const char *path = (argc > 2)? argv[2] : "/tmp/prof-bench.heap";
+	static const size_t rates[] = {0, 0, 4 << 20, 512 << 10, 64 << 10};	//the first run warms the heap up
+	double t, est_live, est_alloc;
+	size_t r, size;
+	long i;
+
+	mem_init();
+	mm_set_trim_threshold(0);
+	printf("%-14s %12s\n", "rate", "malloc+free");
+	for(r = 0; r < sizeof(rates) / sizeof(rates[0]); r++){
+		srand(1);
+		mem_reset_brk();
+		mm_init();
+		memset(ring, 0, sizeof(ring));
+		live = allocated = 0;
+		mm_set_profile(0);	//forget the samples of the last run
+		mm_set_profile(rates[r]);
+		t = now();
+		for(i = 0; i < ops; i++){
+			size = 16 + rand() % 4081;
+			allocated += size;
+			if(i % 16 == 0)
+				leak(size);
+			else if(i % 2 == 0)
+				transient(size);
+			else
+				cached(i / 2, size);
+		}
+		t = now() - t;
+		if(r == 0)
+			continue;
+		if(rates[r] == 0)
+			printf("%-14s %9.1f ns\n", "off", t * 1e9 / ops);
+		else
+			printf("%-3lu KiB %16.1f ns\n", (unsigned long)rates[r] >> 10, t * 1e9 / ops);
+	}
+
+	t = now();
+	if(mm_profile_dump(path) != 0){
+		perror(path);
+		return 1;
+	}
+	t = now() - t;
+	estimate(path, &est_live, &est_alloc);
+	printf("dump to %s: %.2f ms\n", path, t * 1e3);
+	printf("%-10s %14s %14s %8s\n", "", "bytes", "estimated", "error");
+	printf("%-10s %14lu %14.0f %7.1f%%\n", "live", (unsigned long)live, est_live, (est_live / live - 1) * 100);
+	printf("%-10s %14lu %14.0f %7.1f%%\n", "allocated", (unsigned long)allocated, est_alloc,
+		(est_alloc / allocated - 1) * 100);
+	mm_set_profile(0);
+	return 0;
+}
@@ -0,0 +1,173 @@
+/******************************************************************************************************
+ * thp-bench: pointer chasing and churn over a large heap, to compare a build with -DMM_HUGE_PAGES    *
+ * (transparent huge pages) against one without                                                       *
+ *                                                                                                    *
+ * NODES linked nodes of 24-104 bytes are allocated, linked in a random order and then                *
+ * 1. chase: followed for HOPS hops, every hop a load from a random place in the heap                 *
+ * 2. churn: mallocs and frees of 24-512 bytes at random places of a live set of NODES / 8 blocks     *
+ * once on the main arena (memlib) and once from a thread of its own, on an arena that mmap reserved. *
+ * Reported: ns per hop and dTLB load misses per hop (from perf_event_open, "-" where the kernel or   *
+ * the machine gives no such counter), Mops/s of the churn, and how much of the process was backed    *
+ * by huge pages at the end (AnonHugePages of /proc/self/smaps_rollup). THP has to be enabled or at   *
+ * least set to madvise in /sys/kernel/mm/transparent_hugepage/enabled. memlib's MAX_HEAP has to hold *
+ * the nodes.                                                                                         *
+ *                                                                                                    *
+ * Build it twice with the stand-ins in bench/ (or the lab's memlib.c and mm.h), e.g.                 *
+ *	gcc -O2 -DDRIVER -I. -Ibench "malloc V4.c" bench/memlib.c bench/thp-bench.c -lpthread         *
+ *	gcc -O2 -DDRIVER -DMM_HUGE_PAGES -I. -Ibench "malloc V4.c" bench/memlib.c bench/thp-bench.c   *
+ *		-lpthread                                                                             *
+ * and run it as thp-bench [NODES [HOPS]], default 4000000 and 20000000.                              *
+ ******************************************************************************************************/
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+typedef struct node{
+	struct node *next;
+	long payload;
+} node_t;
+
+static long nodes = 4000000, hops = 20000000;
+static node_t **all;	//every node, in the order they were allocated
+
+static double now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static unsigned long next_rand(unsigned long *seed){
+	*seed ^= *seed << 13;	//xorshift64
+	*seed ^= *seed >> 7;
+	*seed ^= *seed << 17;
+	return *seed;
+}
+
+//a counter of the dTLB load misses of this thread, -1 if there is none
+static int dtlb_open(void){
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+		| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static long huge_kib(void){
+	FILE *f = fopen("/proc/self/smaps_rollup", "r");
+	char line[256];
+	long kib = -1;
+
+	if(f == NULL)
+		return -1;
+	while(fgets(line, sizeof(line), f) != NULL)
+		if(sscanf(line, "AnonHugePages: %ld kB", &kib) == 1)
+			break;
+	fclose(f);
+	return kib;
+}
+
+/*********************************************************
+ * run - both workloads on the arena of the calling      *
+ * thread, named name                                    *
+ *********************************************************/
+static void *run(void *name){
+	unsigned long seed = 88172645463325252ul;
+	int fd = dtlb_open();
+	long i, j, live = nodes / 8;
+	long long misses = 0;
+	double t, chase, churn;
+	node_t *n, *tmp;
+
+	for(i = 0; i < nodes; i++){
+		all[i] = mm_malloc(24 + 8 * (next_rand(&seed) % 11));
+		if(all[i] == NULL){
+			fprintf(stderr, "%s: out of memory after %ld nodes\n", (char *)name, i);
+			exit(1);
+		}
+	}
+	for(i = nodes - 1; i > 0; i--){	//shuffle, then link in that order
+		j = next_rand(&seed) % (i + 1);
+		tmp = all[i];
+		all[i] = all[j];
+		all[j] = tmp;
+	}
+	for(i = 0; i < nodes; i++)
+		all[i]->next = all[(i + 1) % nodes];
+
+	if(fd != -1){
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+	t = now();
+	for(n = all[0], i = 0; i < hops; i++)
+		n = n->next;
+	chase = now() - t;
+	if(fd != -1){
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		if(read(fd, &misses, sizeof(misses)) != sizeof(misses))
+			misses = -1;
+		close(fd);
+	}
+	if(n == NULL)	//keep the loop
+		puts("");
+
+	t = now();
+	for(i = 0; i < 4 * nodes; i++){
+		j = next_rand(&seed) % live;
+		mm_free(all[j]);
+		if((all[j] = mm_malloc(24 + next_rand(&seed) % 489)) == NULL){
+			fprintf(stderr, "%s: out of memory in the churn\n", (char *)name);
+			exit(1);
+		}
+	}
+	churn = now() - t;
+
+	printf("%-8s %10.1f", (char *)name, chase * 1e9 / hops);
+	if(fd != -1 && misses >= 0)
+		printf(" %12.3f", (double)misses / hops);
+	else
+		printf(" %12s", "-");
+	printf(" %10.2f %10ld\n", 2.0 * 4 * nodes / churn * 1e-6, huge_kib() / 1024);
+
+	for(i = 0; i < nodes; i++)
+		mm_free(all[i]);
+	return NULL;
+}
+
+int main(int argc, char **argv){
+	pthread_t th;
+
+	if(argc > 1)
+		nodes = atol(argv[1]);
+	if(argc > 2)
+		hops = atol(argv[2]);
+	all = malloc(nodes * sizeof(node_t *));
+	mem_init();
+	mem_reset_brk();
+	mm_init();
+#ifdef MM_HUGE_PAGES
+	printf("huge pages (MM_HUGE_PAGES)\n");
+#else
+	printf("base pages\n");
+#endif
+	printf("%-8s %10s %12s %10s %10s\n", "arena", "ns/hop", "dTLB miss/hop", "churn Mops", "huge MiB");
+	run("main");
+	pthread_create(&th, NULL, run, "thread");
+	pthread_join(th, NULL);
+	return 0;
+}
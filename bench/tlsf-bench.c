@@ -0,0 +1,150 @@
+/******************************************************************************************************
+ * tlsf-bench: latency of single calls with the tree of free blocks and with -DMM_TLSF                *
+ *                                                                                                    *
+ * Every malloc and free of three traces is timed on its own and the median, p99.99 and worst case    *
+ * are reported:                                                                                      *
+ * 1. random: OPS random calls over 4000 slots of 300 bytes to 64 KiB                                 *
+ * 2. distinct: the heap is cut into N free blocks of N different sizes between allocated ones, then  *
+ *    OPS/2 times a random size is allocated and freed, so the tree is as large as it gets            *
+ * 3. sawtooth: N blocks of growing sizes are allocated, the odd ones freed from the top, then the    *
+ *    even ones, over and over, which keeps the tree rebalancing                                      *
+ * Each trace runs twice and the second run is reported, once the first has faulted the heap in.      *
+ * The quick lists, trimming and the decay are off in both builds, only the free lists differ.        *
+ *                                                                                                    *
+ * Build it twice with the stand-ins in bench/ (or the lab's memlib.c and mm.h), once adding          *
+ * -DMM_TLSF, e.g.                                                                                    *
+ *	gcc -O2 -DDRIVER -I. -Ibench "malloc V4.c" bench/memlib.c bench/tlsf-bench.c -lpthread        *
+ * and run it as tlsf-bench [OPS [N]], default 1000000 and 10000.                                     *
+ ******************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "mm_ext.h"
+
+#define SLOTS	4000
+
+static double *lat;	//ns of every call of a trace
+static size_t nlat;
+
+static double now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void *timed_malloc(size_t size){
+	double t = now();
+	void *p = mm_malloc(size);
+
+	lat[nlat++] = now() - t;
+	if(p == NULL){
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	return p;
+}
+
+static void timed_free(void *p){
+	double t = now();
+
+	mm_free(p);
+	lat[nlat++] = now() - t;
+}
+
+static int cmp(const void *a, const void *b){
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void report(const char *name){
+	qsort(lat, nlat, sizeof(double), cmp);
+	printf("%-10s %10lu calls %9.0f ns %9.0f ns %9.0f ns\n", name, (unsigned long)nlat,
+		lat[nlat / 2], lat[(size_t)(nlat * 0.9999)], lat[nlat - 1]);
+}
+
+static void trace_random(long ops){
+	static void *slot[SLOTS];
+	long op;
+	int i;
+
+	for(op = 0; op < ops; op++){
+		i = rand() % SLOTS;
+		if(slot[i] == NULL)
+			slot[i] = timed_malloc(300 + rand() % 65236);
+		else{
+			timed_free(slot[i]);
+			slot[i] = NULL;
+		}
+	}
+	for(i = 0; i < SLOTS; i++)
+		if(slot[i] != NULL){
+			mm_free(slot[i]);
+			slot[i] = NULL;
+		}
+}
+
+static void trace_distinct(long ops, int n){
+	void **blocks = malloc(2 * n * sizeof(void *));
+	long op;
+	int i;
+
+	for(i = 0; i < 2 * n; i++)	//free sizes 512, 520, ... with allocated blocks between them
+		blocks[i] = mm_malloc((i % 2)? 64 : 512 + 8 * (size_t)(i / 2));
+	for(i = 0; i < 2 * n; i += 2)
+		mm_free(blocks[i]);
+	for(op = 0; op < ops / 2; op++)
+		timed_free(timed_malloc(500 + 8 * (size_t)(rand() % n)));
+	for(i = 1; i < 2 * n; i += 2)
+		mm_free(blocks[i]);
+	free(blocks);
+}
+
+static void trace_sawtooth(long ops, int n){
+	void **blocks = malloc(n * sizeof(void *));
+	int i;
+
+	while((long)nlat < ops){
+		for(i = 0; i < n; i++)
+			blocks[i] = timed_malloc(300 + 8 * (size_t)i);
+		for(i = n - 1 - !(n % 2); i >= 0; i -= 2)
+			timed_free(blocks[i]);
+		for(i = n - 1 - n % 2; i >= 0; i -= 2)
+			timed_free(blocks[i]);
+	}
+	free(blocks);
+}
+
+int main(int argc, char **argv){
+	long ops = (argc > 1)? atol(argv[1]) : 1000000;
+	int n = (argc > 2)? atoi(argv[2]) : 10000;
+	const char *names[3] = {"random", "distinct", "sawtooth"};
+	int trace, pass;
+
+	lat = malloc((ops + 4 * (size_t)n) * sizeof(double));
+	mem_init();
+	mm_set_quick(0);
+	mm_set_trim_threshold(0);
+	mm_set_decay(0);
+	printf("%-10s %16s %12s %12s %12s\n", "", "", "median", "p99.99", "worst");
+	for(trace = 0; trace < 3; trace++){
+		for(pass = 0; pass < 2; pass++){	//the first one faults the heap in
+			srand(1);
+			nlat = 0;
+			mem_reset_brk();
+			mm_init();
+			if(trace == 0)
+				trace_random(ops);
+			else if(trace == 1)
+				trace_distinct(ops, n);
+			else
+				trace_sawtooth(ops, n);
+		}
+		report(names[trace]);
+	}
+	free(lat);
+	return 0;
+}
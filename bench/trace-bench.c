@@ -0,0 +1,466 @@
+/******************************************************************************************************
+ * trace-bench: replay allocation traces against the allocator and the system malloc                  *
+ *                                                                                                    *
+ * Traces are in mdriver format: suggested heap size, number of ids, number of ops, weight, then one  *
+ * op per line: "a id size", "f id" or "r id size". Every trace is replayed                           *
+ * 1. for throughput: as many times as it takes to run about REPLAY_OPS ops, reported in Kops/s       *
+ * 2. for latency: once more with every op timed on its own, reported as percentiles in ns (the       *
+ *    clock itself costs a few tens of ns)                                                            *
+ * against mm_malloc/mm_free/mm_realloc on a fresh memlib heap (mm), the same with every malloc       *
+ * turned into an mm_malloc_hint (mm-hint), with the quick lists turned off so that every free        *
+ * coalesces at once (mm-nq), and against malloc/free/realloc. The mm rows show what deferred         *
+ * coalescing and the hints trade: throughput against utilization, both mdriver's (util: the peak of  *
+ * the live payload over the final heap size) and in steady state (steady: the mean live payload over *
+ * the mean heap size, taken after every op). The hints come from the trace itself: a block freed or  *
+ * reallocated within HINT_OPS ops of its malloc is short-lived, any other long-lived.                *
+ *                                                                                                    *
+ * Without arguments the synthetic traces below are replayed:                                         *
+ *	storm: bursts of same-size blocks, freed every other one and refilled                         *
+ *	ascend, descend: blocks of steadily growing (shrinking) size, freed and refilled in order,    *
+ *		which turns an unbalanced size tree into a list                                       *
+ *	realloc: interleaved chains of blocks that grow by half again at every step                   *
+ *	bintree: binary trees built and freed depth first, next to a long lived one                   *
+ *	server: sessions that stay for thousands of requests, each request with a buffer that goes    *
+ *		a few requests later                                                                  *
+ * trace-bench FILE... replays trace files instead; trace-bench -o DIR writes the synthetic traces to *
+ * DIR as .rep files.                                                                                 *
+ *                                                                                                    *
+ * Build it with the stand-ins in bench/ (or the lab's memlib.c and mm.h), e.g.                       *
+ *	gcc -O2 -DDRIVER -I. -Ibench "malloc V4.c" bench/memlib.c bench/trace-bench.c -lpthread       *
+ ******************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "mm_ext.h"
+
+#define REPLAY_OPS	2000000	//ops per throughput measurement, at least one replay
+#define HINT_OPS	1000	//a block freed within this many ops of its malloc is short-lived
+
+typedef struct{
+	char type;	//'a', 'f' or 'r'
+	int id;
+	size_t size;
+	int hint;	//of an 'a': MM_SHORT_LIVED or MM_LONG_LIVED, by how soon the block goes
+} op_t;
+
+typedef struct{
+	char name[64];
+	int num_ids;
+	int num_ops;
+	int cap;
+	op_t *ops;
+} trace_t;
+
+typedef struct{	//the allocator under test
+	const char *name;
+	void (*reset)(void);
+	void *(*malloc)(size_t size);
+	void (*free)(void *ptr);
+	void *(*realloc)(void *ptr, size_t size);
+	void *(*malloc_hint)(size_t size, int hint);	//used instead of malloc if not NULL
+} alloc_t;
+
+static void mm_reset(void){
+	mm_set_quick(32);	//the default
+	mem_reset_brk();
+	mm_init();
+}
+
+static void mm_nq_reset(void){
+	mm_set_quick(0);
+	mem_reset_brk();
+	mm_init();
+}
+
+static void libc_reset(void){
+}
+
+#define ALLOCATORS	4
+static const alloc_t allocators[ALLOCATORS] = {
+	{"mm", mm_reset, mm_malloc, mm_free, mm_realloc, NULL},
+	{"mm-hint", mm_reset, mm_malloc, mm_free, mm_realloc, mm_malloc_hint},
+	{"mm-nq", mm_nq_reset, mm_malloc, mm_free, mm_realloc, NULL},
+	{"libc", libc_reset, malloc, free, realloc, NULL}
+};
+
+static double now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/******************************************************************************************************
+ *                                              Traces                                                *
+ ******************************************************************************************************/
+static void trace_op(trace_t *t, char type, int id, size_t size){
+	if(t->num_ops == t->cap){
+		t->cap = (t->cap == 0)? 1024 : 2 * t->cap;
+		t->ops = realloc(t->ops, t->cap * sizeof(op_t));
+	}
+	t->ops[t->num_ops].type = type;
+	t->ops[t->num_ops].id = id;
+	t->ops[t->num_ops].size = size;
+	t->num_ops++;
+	if(id >= t->num_ids)
+		t->num_ids = id + 1;
+}
+
+/*********************************************************
+ * trace_read - read an mdriver trace, return 0 on       *
+ * success                                               *
+ *********************************************************/
+static int trace_read(trace_t *t, const char *path){
+	FILE *f = fopen(path, "r");
+	int heap, ids, ops, weight, id, i;
+	unsigned long size;
+	char type;
+
+	memset(t, 0, sizeof(*t));
+	snprintf(t->name, sizeof(t->name), "%s", strrchr(path, '/')? strrchr(path, '/') + 1 : path);
+	if(f == NULL)
+		return -1;
+	if(fscanf(f, "%d %d %d %d", &heap, &ids, &ops, &weight) != 4){
+		fclose(f);
+		return -1;
+	}
+	for(i = 0; i < ops && fscanf(f, " %c", &type) == 1; i++){
+		size = 0;
+		if(type == 'f'){
+			if(fscanf(f, "%d", &id) != 1)
+				break;
+		}
+		else if(fscanf(f, "%d %lu", &id, &size) != 2)
+			break;
+		trace_op(t, type, id, size);
+	}
+	fclose(f);
+	return (t->num_ops == ops)? 0 : -1;
+}
+
+/*********************************************************
+ * trace_write - write t to dir/<name>.rep               *
+ *********************************************************/
+static void trace_write(const trace_t *t, const char *dir){
+	char path[512];
+	FILE *f;
+	int i;
+
+	snprintf(path, sizeof(path), "%.400s/%.64s.rep", dir, t->name);
+	if((f = fopen(path, "w")) == NULL){
+		perror(path);
+		return;
+	}
+	fprintf(f, "0\n%d\n%d\n1\n", t->num_ids, t->num_ops);
+	for(i = 0; i < t->num_ops; i++){
+		if(t->ops[i].type == 'f')
+			fprintf(f, "f %d\n", t->ops[i].id);
+		else
+			fprintf(f, "%c %d %lu\n", t->ops[i].type, t->ops[i].id, (unsigned long)t->ops[i].size);
+	}
+	fclose(f);
+}
+
+/*********************************************************
+ * trace_hints - tell every malloc of t whether its      *
+ * block is freed (or reallocated) within HINT_OPS ops   *
+ *********************************************************/
+static void trace_hints(trace_t *t){
+	int *last = malloc(t->num_ids * sizeof(int));	//the malloc of every id still live, -1: none
+	int i;
+
+	for(i = 0; i < t->num_ids; i++)
+		last[i] = -1;
+	for(i = 0; i < t->num_ops; i++){
+		op_t *op = &t->ops[i];
+
+		if(op->type != 'a' && last[op->id] != -1)
+			t->ops[last[op->id]].hint = (i - last[op->id] < HINT_OPS)? MM_SHORT_LIVED : MM_LONG_LIVED;
+		last[op->id] = (op->type == 'a')? i : -1;
+		if(op->type == 'a')
+			op->hint = MM_LONG_LIVED;	//unless it is freed in time
+	}
+	free(last);
+}
+
+/*********************************************************
+ * gen_storm - bursts of blocks of one size              *
+ *********************************************************/
+static void gen_storm(trace_t *t){
+	static const size_t sizes[] = {512, 1000, 4072, 40, 2040};
+	int burst = 4000, s, i, base;
+
+	snprintf(t->name, sizeof(t->name), "storm");
+	for(s = 0; s < 5; s++){
+		base = s * burst;
+		for(i = 0; i < burst; i++)
+			trace_op(t, 'a', base + i, sizes[s]);
+		for(i = 0; i < burst; i += 2)
+			trace_op(t, 'f', base + i, 0);
+		for(i = 0; i < burst; i += 2)
+			trace_op(t, 'a', base + i, sizes[s]);
+	}
+	for(i = 0; i < 5 * burst; i++)
+		trace_op(t, 'f', i, 0);
+}
+
+/*********************************************************
+ * gen_sweep - blocks of strictly monotonic sizes, each  *
+ * followed by a small block that keeps them apart once  *
+ * freed; then free and refill them in the same order   *
+ *********************************************************/
+static void gen_sweep(trace_t *t, int descend){
+	int n = 3000, i;
+
+	snprintf(t->name, sizeof(t->name), descend? "descend" : "ascend");
+	for(i = 0; i < n; i++){
+		int k = descend? n - i : i + 1;
+		trace_op(t, 'a', 2 * i, 256 + 16 * k);
+		trace_op(t, 'a', 2 * i + 1, 300);
+	}
+	for(i = 0; i < n; i++)
+		trace_op(t, 'f', 2 * i, 0);
+	for(i = 0; i < n; i++){
+		int k = descend? n - i : i + 1;
+		trace_op(t, 'a', 2 * i, 256 + 16 * k + 8);
+	}
+	for(i = 0; i < 2 * n; i++)
+		trace_op(t, 'f', i, 0);
+}
+
+/*********************************************************
+ * gen_realloc - chains that grow by half at every step, *
+ * with a short lived block between the steps            *
+ *********************************************************/
+static void gen_realloc(trace_t *t){
+	int chains = 64, i, c;
+	size_t size[64];
+
+	snprintf(t->name, sizeof(t->name), "realloc");
+	for(c = 0; c < chains; c++){
+		size[c] = 16 + 8 * c;
+		trace_op(t, 'a', c, size[c]);
+	}
+	for(i = 0; i < 24; i++)
+		for(c = 0; c < chains; c++){
+			size[c] += size[c] / 2;
+			if(size[c] > (1 << 20))	//start over
+				size[c] = 16 + 8 * c;
+			trace_op(t, 'r', c, size[c]);
+			trace_op(t, 'a', chains + c, 64 + 32 * (c % 8));
+			trace_op(t, 'f', chains + c, 0);
+		}
+	for(c = 0; c < chains; c++)
+		trace_op(t, 'f', c, 0);
+}
+
+/*********************************************************
+ * gen_tree - allocate a binary tree of the given depth, *
+ * nodes numbered from id; return the next free id       *
+ *********************************************************/
+static int gen_tree(trace_t *t, int id, int depth){
+	int next = id + 1;
+
+	trace_op(t, 'a', id, (depth % 3 == 0)? 300 : 24 + 8 * (depth % 4));
+	if(depth > 0){
+		next = gen_tree(t, next, depth - 1);
+		next = gen_tree(t, next, depth - 1);
+	}
+	return next;
+}
+
+static void gen_bintree(trace_t *t){
+	int lived, depth, i, end;
+
+	snprintf(t->name, sizeof(t->name), "bintree");
+	lived = gen_tree(t, 0, 12);	//long lived
+	for(depth = 4; depth <= 14; depth += 2)
+		for(i = 0; i < (1 << (14 - depth)); i++){
+			end = gen_tree(t, lived, depth);
+			while(end > lived)	//free depth first, children before their parent
+				trace_op(t, 'f', --end, 0);
+		}
+	for(i = 0; i < lived; i++)
+		trace_op(t, 'f', i, 0);
+}
+
+/*********************************************************
+ * gen_server - sessions that stay for a long time, with *
+ * request buffers that go after a few requests, mixed   *
+ *********************************************************/
+static void gen_server(trace_t *t){
+	int sessions = 2000, slots = 16, steps = 200000, live = 0, i, k;
+	int open[2000];
+
+	snprintf(t->name, sizeof(t->name), "server");
+	srand(1);
+	for(i = 0; i < steps; i++){
+		k = i % slots;	//the buffer of slots requests ago goes
+		if(i >= slots)
+			trace_op(t, 'f', k, 0);
+		trace_op(t, 'a', k, 64 + rand() % 4033);
+		if(i % 8 == 0){	//a session opens, a random one closes when there are enough
+			if(live == sessions){
+				k = rand() % sessions;
+				trace_op(t, 'f', open[k], 0);
+			}
+			else
+				k = live++;
+			open[k] = slots + i / 8;
+			trace_op(t, 'a', open[k], 100 + rand() % 1901);
+		}
+	}
+	for(i = 0; i < slots; i++)
+		trace_op(t, 'f', i, 0);
+	for(i = 0; i < live; i++)
+		trace_op(t, 'f', open[i], 0);
+}
+
+/******************************************************************************************************
+ *                                               Replay                                               *
+ ******************************************************************************************************/
+/*********************************************************
+ * replay - run t once on allocator a; time every op     *
+ * into lat and sum the live payload and the heap size   *
+ * after every op into *steady if lat is not NULL.       *
+ * Returns the peak payload, 0 if an allocation failed   *
+ *********************************************************/
+static size_t replay(const trace_t *t, const alloc_t *a, void **ptrs, size_t *sizes, double *lat, double *steady){
+	size_t live = 0, peak = 0;
+	double t0 = 0, live_sum = 0, heap_sum = 0;
+	int i;
+
+	memset(ptrs, 0, t->num_ids * sizeof(void *));
+	memset(sizes, 0, t->num_ids * sizeof(size_t));
+	a->reset();
+	for(i = 0; i < t->num_ops; i++){
+		const op_t *op = &t->ops[i];
+		void *p;
+
+		if(lat != NULL)
+			t0 = now();
+		switch(op->type){
+		case 'a':
+			p = (a->malloc_hint != NULL)? a->malloc_hint(op->size, op->hint) : a->malloc(op->size);
+			break;
+		case 'r':
+			p = a->realloc(ptrs[op->id], op->size);
+			break;
+		default:
+			a->free(ptrs[op->id]);
+			p = NULL;
+		}
+		if(lat != NULL)
+			lat[i] = now() - t0;
+
+		if(op->type != 'f' && p == NULL)
+			return 0;
+		ptrs[op->id] = p;
+		live += op->size - sizes[op->id];
+		sizes[op->id] = op->size;
+		if(live > peak)
+			peak = live;
+		if(lat != NULL){
+			live_sum += live;
+			heap_sum += mem_heapsize();
+		}
+	}
+	if(lat != NULL)
+		*steady = (heap_sum != 0)? live_sum / heap_sum : 0;
+	for(i = 0; i < t->num_ids; i++)	//whatever the trace leaves behind
+		if(ptrs[i] != NULL && sizes[i] != 0)
+			a->free(ptrs[i]);
+	return peak;
+}
+
+static int cmp_double(const void *x, const void *y){
+	double a = *(const double *)x, b = *(const double *)y;
+	return (a > b) - (a < b);
+}
+
+static void run(const trace_t *t){
+	void **ptrs = malloc(t->num_ids * sizeof(void *));
+	size_t *sizes = malloc(t->num_ids * sizeof(size_t));
+	double *lat = malloc(t->num_ops * sizeof(double));
+	int reps = (t->num_ops < REPLAY_OPS)? REPLAY_OPS / t->num_ops : 1;
+	int k, r;
+
+	for(k = 0; k < ALLOCATORS; k++){
+		const alloc_t *a = &allocators[k];
+		size_t peak = 0;
+		double t0, secs, steady;
+
+		t0 = now();
+		for(r = 0; r < reps; r++)
+			peak = replay(t, a, ptrs, sizes, NULL, NULL);
+		secs = now() - t0;
+		if(peak == 0){
+			printf("%-10s %-7s out of memory\n", t->name, a->name);
+			continue;
+		}
+		if(a->malloc == mm_malloc)	//mem_heapsize is the heap of the last replay
+			printf("%-10s %-7s %8d %6.1f%%", t->name, a->name, t->num_ops, 100.0 * peak / mem_heapsize());
+		else
+			printf("%-10s %-7s %8d %7s", t->name, a->name, t->num_ops, "-");
+
+		replay(t, a, ptrs, sizes, lat, &steady);
+		if(a->malloc == mm_malloc)
+			printf(" %6.1f%%", 100.0 * steady);
+		else
+			printf(" %7s", "-");
+		qsort(lat, t->num_ops, sizeof(double), cmp_double);
+		printf(" %10.0f %8.0f %8.0f %8.0f %8.0f %10.0f\n", (double)reps * t->num_ops / secs * 1e-3,
+			lat[t->num_ops / 2] * 1e9, lat[(int)(t->num_ops * 0.99)] * 1e9,
+			lat[(int)(t->num_ops * 0.999)] * 1e9, lat[(int)(t->num_ops * 0.9999)] * 1e9,
+			lat[t->num_ops - 1] * 1e9);
+	}
+	free(lat);
+	free(sizes);
+	free(ptrs);
+}
+
+int main(int argc, char **argv){
+	trace_t traces[6];
+	int n = 0, i;
+
+	memset(traces, 0, sizeof(traces));
+	if(argc > 1 && strcmp(argv[1], "-o") != 0){
+		mem_init();
+		printf("%-10s %-7s %8s %7s %7s %10s %8s %8s %8s %8s %10s\n", "trace", "alloc", "ops", "util",
+			"steady", "Kops/s", "p50", "p99", "p99.9", "p99.99", "max ns");
+		for(i = 1; i < argc; i++){
+			if(trace_read(&traces[0], argv[i]) != 0)
+				fprintf(stderr, "%s: not an mdriver trace\n", argv[i]);
+			else{
+				trace_hints(&traces[0]);
+				run(&traces[0]);
+			}
+			free(traces[0].ops);
+		}
+		return 0;
+	}
+
+	gen_storm(&traces[n++]);
+	gen_sweep(&traces[n++], 0);
+	gen_sweep(&traces[n++], 1);
+	gen_realloc(&traces[n++]);
+	gen_bintree(&traces[n++]);
+	gen_server(&traces[n++]);
+	if(argc > 2){
+		for(i = 0; i < n; i++)
+			trace_write(&traces[i], argv[2]);
+		return 0;
+	}
+
+	mem_init();
+	printf("%-10s %-7s %8s %7s %7s %10s %8s %8s %8s %8s %10s\n", "trace", "alloc", "ops", "util",
+		"steady", "Kops/s", "p50", "p99", "p99.9", "p99.99", "max ns");
+	for(i = 0; i < n; i++){
+		trace_hints(&traces[i]);
+		run(&traces[i]);
+	}
+	return 0;
+}
@@ -0,0 +1,117 @@
+/******************************************************************************************************
+ * trim-bench: resident memory after a spike, against throughput                                     *
+ *                                                                                                    *
+ * Every policy runs in a child process of its own on a fresh memlib heap:                            *
+ * 1. busy: ROUNDS times, allocate SPIKE MiB of 1-64 KiB blocks with a small long lived block after   *
+ *    every 16th one (they pin the heap), then free the large blocks. Timed, reported in Mops/s.      *
+ * 2. idle: IDLE ms of light malloc/free traffic, so that decay gets a chance to run.                 *
+ * RSS is read from /proc/self/statm after the last spike, after its frees and after the idle phase.  *
+ * Policies: off (no trimming, no decay), trim (automatic trimming only), decay (automatic trimming   *
+ * and decay of DECAY ms), mm_trim (off, then one mm_trim(0) before idling).                          *
+ * memlib's MAX_HEAP has to hold SPIKE MiB and a bit more.                                            *
+ *                                                                                                    *
+ * Build it with the stand-ins in bench/ (or the lab's memlib.c and mm.h), e.g.                       *
+ *	gcc -O2 -DDRIVER -I. -Ibench "malloc V4.c" bench/memlib.c bench/trim-bench.c -lpthread        *
+ * and run it as trim-bench [SPIKE [ROUNDS [IDLE [DECAY]]]], default 64 10 1500 500.                  *
+ ******************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "mm_ext.h"
+
+#define PIN_EVERY	16
+
+enum {OFF, TRIM, DECAY, MM_TRIM, POLICIES};
+static const char *names[POLICIES] = {"off", "trim", "decay", "mm_trim"};
+
+static double now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double rss_mib(void){
+	long pages = 0, resident = 0;
+	FILE *f = fopen("/proc/self/statm", "r");
+
+	if(f != NULL){
+		if(fscanf(f, "%ld %ld", &pages, &resident) != 2)
+			resident = 0;
+		fclose(f);
+	}
+	return resident * (double)sysconf(_SC_PAGESIZE) / (1 << 20);
+}
+
+static void run(int policy, size_t spike, int rounds, int idle, int decay){
+	size_t count = spike / (32 << 10);	//1-64 KiB blocks, 32 KiB on average
+	void **blocks = malloc(count * sizeof(void *));
+	void **pins = calloc(rounds * (count / PIN_EVERY + 1), sizeof(void *));
+	double t, busy, at_spike = 0, at_free = 0;
+	size_t i, npins = 0;
+	long ops = 0;
+	int r;
+
+	mem_init();
+	mm_init();
+	mm_set_trim_threshold((policy == TRIM || policy == DECAY)? 128 << 10 : 0);
+	mm_set_decay((policy == DECAY)? decay : 0);
+	srand(1);
+
+	t = now();
+	for(r = 0; r < rounds; r++){
+		for(i = 0; i < count; i++){
+			size_t size = 1024 + rand() % (63 << 10), k;
+			blocks[i] = mm_malloc(size);
+			for(k = 0; k < size; k += 4096)	//every page of it becomes resident
+				((char *)blocks[i])[k] = 1;
+			if(i % PIN_EVERY == 0)
+				pins[npins++] = mm_malloc(512);
+		}
+		at_spike = rss_mib();
+		for(i = 0; i < count; i++)
+			mm_free(blocks[i]);
+		ops += count * 2 + count / PIN_EVERY;
+	}
+	busy = now() - t;
+	at_free = rss_mib();
+
+	if(policy == MM_TRIM)
+		mm_trim(0);
+	t = now();
+	while(now() - t < idle * 1e-3){
+		for(i = 0; i < 64; i++)
+			blocks[i] = mm_malloc(300 + i);
+		for(i = 0; i < 64; i++)
+			mm_free(blocks[i]);
+		usleep(1000);
+	}
+	printf("%-8s %10.2f %12.1f %12.1f %12.1f\n", names[policy], ops / busy * 1e-6,
+		at_spike, at_free, rss_mib());
+	free(pins);
+	free(blocks);
+}
+
+int main(int argc, char **argv){
+	size_t spike = (size_t)((argc > 1)? atoi(argv[1]) : 64) << 20;
+	int rounds = (argc > 2)? atoi(argv[2]) : 10;
+	int idle = (argc > 3)? atoi(argv[3]) : 1500;
+	int decay = (argc > 4)? atoi(argv[4]) : 500;
+	int policy;
+
+	printf("spike %lu MiB x %d, idle %d ms, decay %d ms\n", (unsigned long)(spike >> 20), rounds, idle, decay);
+	printf("%-8s %10s %12s %12s %12s\n", "policy", "Mops/s", "RSS spike", "RSS freed", "RSS idle");
+	fflush(stdout);
+	for(policy = 0; policy < POLICIES; policy++){
+		if(fork() == 0){
+			run(policy, spike, rounds, idle, decay);
+			exit(0);
+		}
+		wait(NULL);
+	}
+	return 0;
+}
@@ -4,33 +4,66 @@
  * Version 4.0                                                                                        *
  *                                                                                                    *
  * Basic Information:                                                                                 *
- * 1. Inplementation with binary search tree (explicit list)                                          *
+ * 1. Inplementation with balanced binary search tree (AVL, explicit list)                            *
  * 2. Alignment by 8 bytes (2 words), each block: no shorter than 4 words                             *
  * 3. Inner displacement protocal of a free block:                                                    *
- *	head (1 word) + left-child-offset (1 word) + right-child-offset (1 word) + ... + foot (1 word)*
+ *	head (1 word) + next-offset (1 word) + prev-offset (1 word) +                                 *
+ *	left-child-offset (1 word) + right-child-offset (1 word) + ... + foot (1 word)                *
  *	head/foot: the length of the block in bytes; last bit: alloc; second last bit: prev-alloc     *
  *	the reason why we use offset instead of addr: otherwise it may take 2 words for a 64-bit addr *
- * 4. The logical structure of the explicit free list is organized into a binary search tree,         *
- *	in which the left child tree represents those blocks                                          *
- *	whose length is shorter than or equal to the length of current block                          *
+ * 4. The logical structure of the explicit free list is organized into an AVL tree keyed on size,    *
+ *	with exactly one tree node per distinct size. Other free blocks of the same size hang off     *
+ *	the node in a doubly linked chain (next/prev), so they are added and removed in O(1).        *
+ *	Blocks of the minimum size (4 words) have no room for child offsets and only live in a chain  *
+ *	whose head is min_listp.                                                                      *
  * 5. Prelogue block and epilogue block is included similar to the version described in the text book *
+ * 6. Words are 4 bytes and offsets count bytes, so a heap is at most 4 GiB. Build with                *
+ *	-DMM_SCALED_OFFSETS to count offsets in units of 8 bytes (heaps up to 32 GiB, blocks still    *
+ *	below 4 GiB), or with -DMM_WIDE_WORDS for 8-byte words (16-byte alignment of every block and  *
+ *	small object, whose size classes go up in steps of 16, minimum block of 32 bytes, no          *
+ *	practical limit).                                                                             *
+ * 7. Build with -DMM_SIZE_INDEX to keep the sizes of the tree nodes in a sorted side index as well,  *
+ *	so a best fit is found without a walk down the tree (see the Size Index section).             *
+ * 8. Build with -DMM_TLSF to keep the free blocks in two-level segregated lists instead of the       *
+ *	tree, for malloc and free in constant time (see the Two-Level Segregated Fit section).        *
+ * 9. Build with -DMM_HUGE_PAGES to back the heaps with transparent huge pages: arenas reserve their  *
+ *	heap on a 2 MiB boundary with MADV_HUGEPAGE, heaps grow to huge page boundaries and trimming  *
+ *	and scavenging give back whole huge pages only (see the Trimming and Scavenging section).     *
+ * 10. Without DRIVER the file builds into a shared library that replaces malloc and the rest of the  *
+ *	allocator of the C library through LD_PRELOAD, with fork handlers, no memlib and always with  *
+ *	MM_WIDE_WORDS for the 16-byte alignment of libc (see the Library Build section).              *
  ******************************************************************************************************/
 
 /******************************************************************************************************
  *                                           "do not change"                                          *
  ******************************************************************************************************/
+#define _GNU_SOURCE	//mremap
 #include <assert.h>
+#include <errno.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unwind.h>
 
+#ifdef DRIVER	/* the library build has neither, see the Library Build section */
 #include "mm.h"
 #include "memlib.h"
+#endif
+#include "mm_ext.h"
 
 /* If you want debugging output, use the following macro.  When you hand
  * in, remove the #define DEBUG line. */
+#ifdef DRIVER	/* never in the library, stdout is the program's */
 #define DEBUG
+#endif
 #ifdef DEBUG
 # define dbg_printf(...) printf(__VA_ARGS__)
 #else
@@ -46,11 +79,41 @@
 #define calloc mm_calloc
 #endif /* def DRIVER */
 
+#ifdef DRIVER	/* the same for the other libc functions of mm_ext.h */
+#define posix_memalign mm_posix_memalign
+#define aligned_alloc mm_aligned_alloc
+#define memalign mm_memalign
+#define free_sized mm_free_sized
+#define malloc_usable_size mm_malloc_usable_size
+#define valloc mm_valloc
+#define pvalloc mm_pvalloc
+#define reallocarray mm_reallocarray
+#endif
+
+#ifndef DRIVER	/* the library aligns as libc does, to 16 bytes: see the Library Build section */
+#if defined(MM_SCALED_OFFSETS)
+#error "the library build takes 16-byte alignment, which MM_SCALED_OFFSETS does not give"
+#elif !defined(MM_WIDE_WORDS)
+#define MM_WIDE_WORDS
+#endif
+#endif
+
+/* the functions of the lab's code that are not static, kept out of the symbols the library exports */
+#ifdef DRIVER
+#define INTERNAL
+#else
+#define INTERNAL	__attribute__((visibility("hidden")))
+#endif
+
 /* single word (4) or double word (8) alignment */
+#ifdef MM_WIDE_WORDS	/* 16, see the basic information (6) */
+#define ALIGNMENT 16
+#else
 #define ALIGNMENT 8
+#endif
 
 /* rounds up to the nearest multiple of ALIGNMENT */
-#define ALIGN(p) (((size_t)(p) + (ALIGNMENT-1)) & ~0x7)
+#define ALIGN(p) (((size_t)(p) + (ALIGNMENT-1)) & ~(size_t)(ALIGNMENT-1))
 
 #define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
 #define SIZE_PTR(p)  ((size_t*)(((char*)(p)) - SIZE_T_SIZE))
@@ -58,35 +121,335 @@
 /******************************************************************************************************
  *                                         Global Variebles                                           *
  ******************************************************************************************************/
-static void* heap_listp;	//CAUTION: 8 bytes in 64-bit system
-static void* free_listp = NULL;	//the root of the BST of free lists
+//header, footer and link words, see the basic information (6)
+#if defined(MM_WIDE_WORDS) && defined(MM_SCALED_OFFSETS)
+#error "MM_WIDE_WORDS and MM_SCALED_OFFSETS do not go together"
+#elif defined(MM_WIDE_WORDS)
+typedef unsigned long word_t;
+#define OFFSET_SHIFT	0
+#define HEAP_MAX	((size_t)1 << 46)	//the most a heap is allowed to grow to
+#define ARENA_SIZE	((size_t)64 << 30)	//address space reserved by every arena but the main one
+#elif defined(MM_SCALED_OFFSETS)
+typedef unsigned int word_t;
+#define OFFSET_SHIFT	3	//offsets count units of ALIGNMENT
+#define HEAP_MAX	((size_t)TREE_TAG(0) << OFFSET_SHIFT)	//offsets stay below the tree tags
+#define ARENA_SIZE	((size_t)32 << 30)
+#else
+typedef unsigned int word_t;
+#define OFFSET_SHIFT	0
+#define HEAP_MAX	((size_t)1 << 32)
+#define ARENA_SIZE	((size_t)1 << 30)
+#endif
+
+//small object slabs, see the Small Object Slabs section
+#define PAGESIZE	(1 << 12)	//size and alignment of a slab
+#define SLAB_MAX	256	//largest request served by a slab
+#define SLAB_CLASSES	16
+#define SLAB_MAP_BITS	(1 << 20)	//slabs only live in the first 4 GiB of the heap
+
+typedef struct slab{
+	struct slab *next;	//slabs of the same class with free objects
+	struct slab *prev;
+	void *free;	//list of freed objects, linked through their first 8 bytes
+	unsigned short used;	//objects handed out
+	unsigned short bump;	//objects never handed out start at this index
+	unsigned short cls;	//size class
+} slab_t;
+
+#ifdef MM_WIDE_WORDS	//every class a multiple of 16, so that small objects are as aligned as heap blocks
+static const unsigned short slab_size[SLAB_CLASSES] = {
+	16, 32, 48, 64, 80, 96, 112, 128, 144, 160, 176, 192, 208, 224, 240, 256};
+static const unsigned char slab_class[SLAB_MAX / ALIGNMENT + 1] = {	//indexed by size in units of ALIGNMENT
+	0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+#else
+static const unsigned short slab_size[SLAB_CLASSES] = {
+	8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256};
+static const unsigned char slab_class[SLAB_MAX / ALIGNMENT + 1] = {	//indexed by size in units of ALIGNMENT
+	0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 8, 9, 9, 10, 10, 11, 11,
+	12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15, 15};
+#endif
+
+//arenas and thread caches, see the Arenas and Thread Caches section
+#define MM_ARENAS	8	//threads are spread over at most this many arenas
+#define TCACHE_MAX	64	//small objects a thread keeps per class before giving half of them back
+#define TCACHE_FILL	16	//small objects a thread takes per class when its cache is empty
+
+//deferred coalescing, see the Quick Lists section
+#define QUICK_MAX	1024	//largest block kept on a quick list
+#define QUICK_LISTS	(QUICK_MAX / (2 * sizeof(word_t)) + 1)	//indexed by block size in units of DSIZE
+#ifdef MM_TLSF
+#define QUICK_LEN	0	//off: flushing them all on a miss is the one unbounded step of a malloc
+#else
+#define QUICK_LEN	32	//default blocks per list before the list is flushed
+#endif
+#define QUICK_LEN_MAX	0xffff
+
+//the out-of-line index of free sizes, see the Size Index section
+#ifdef MM_SIZE_INDEX
+#define IDX_B	16	//sizes per bucket
+#define IDX_NONE	((word_t)~0)	//an unused slot, larger than any size
+
+typedef struct{
+	word_t size[IDX_B];	//distinct sizes of free blocks in the BST, ascending, then IDX_NONE
+	word_t node[IDX_B];	//offset of the tree node of each size
+} idx_bucket_t;
+
+typedef word_t idx_vec_t __attribute__((vector_size(IDX_B * sizeof(word_t))));	//a bucket's sizes
+#endif
+
+//two-level segregated fit, see the Two-Level Segregated Fit section
+#ifdef MM_TLSF
+#ifdef MM_SIZE_INDEX
+#error "MM_SIZE_INDEX and MM_TLSF do not go together"
+#endif
+#define TLSF_SL_SHIFT	4
+#define TLSF_SL	(1 << TLSF_SL_SHIFT)	//second-level bins to a power of two
+#define TLSF_FL	40	//first-level bins, enough for the largest block of every word mode
+#define TLSF_SMALL	(DSIZE << TLSF_SL_SHIFT)	//smaller blocks have a bin of their own size, first level 0
+#endif
+
+//persistent heaps, see the Persistent Heaps section
+#define PHEAP_MAGIC	"mmpheap"
+#define PHEAP_VERSION	1
+#ifdef MM_TLSF
+#define PHEAP_HAS_LISTS(hdr)	0	//the bins are never written
+#else
+#define PHEAP_HAS_LISTS(hdr)	((hdr)->free_root != 0 || (hdr)->min_list != 0 || (hdr)->free_blocks == 0)	//not by MM_TLSF
+#endif
+
+typedef struct{	//page 0 of the file, the heap follows; offsets instead of pointers
+	char magic[8];
+	unsigned int version;
+	unsigned int word_size;	//WSIZE and OFFSET_SHIFT of the build that wrote it
+	unsigned int offset_shift;
+	unsigned int open;	//a process has it open, still set after a crash
+	size_t size;	//reserved for the heap
+	size_t brk;	//from the start of the heap, written on sync
+	size_t free_root;	//free_listp and min_listp from heap_listp, 0: none, written on sync
+	size_t min_list;
+	size_t free_bytes;
+	size_t free_blocks;
+	size_t root;	//the root object from the start of the heap, 0: none
+} pheap_hdr_t;
+
+//an arena is a complete heap with its own backing memory, BST and slabs, guarded by its own lock
+typedef struct arena{
+	pthread_mutex_t lock;
+	void* heap_listp;	//CAUTION: 8 bytes in 64-bit system
+	void* free_listp;	//the root of the BST of free lists
+	void* min_listp;	//the chain of free blocks of minimum size (QSIZE), not in the BST
+	char *lo;	//[lo, brk) is the heap
+	char *brk;
+	char *end;	//[lo, end) is reserved for the heap, NULL for the main arena (memlib)
+	char *fresh;	//memory from here on has never been handed out and is still zero
+	void *remote;	//blocks freed by threads that could not take the lock, linked through their payload
+	unsigned int frees;	//frees since the decay clock was last read
+	unsigned long scavenged_at;	//when free pages were last released (ms), 0 before the first look
+	unsigned int grow_shift;	//the heap grows by its size >> grow_shift
+	size_t grow_step;	//or by this much if not 0, see mm_heap_set_grow_step
+	size_t sbrks;	//calls to arena_sbrk
+	char *touched;	//nothing from here on has been handed out since the arena was initialized
+	pheap_hdr_t *pheap;	//the file the heap is mapped from, NULL: anonymous memory
+
+	//statistics, see the Statistics section
+	size_t free_bytes;	//in the BST and min_listp
+	size_t free_blocks;
+	size_t splits;
+	size_t coalesces[4];	//by case in coalesce
+	size_t fit_misses;
+	size_t fit_depth[MM_STAT_DEPTHS];
+
+#ifdef MM_TLSF
+	//segregated free lists, see the Two-Level Segregated Fit section
+	unsigned long tlsf_fl_map;	//bit fl: some bin of first level fl is not empty
+	unsigned int tlsf_sl_map[TLSF_FL];	//bit sl: bin sl of first level fl is not empty
+	void *tlsf_bins[TLSF_FL * TLSF_SL];	//the first block of every bin, by tlsf_bin
+#endif
+#ifdef MM_SIZE_INDEX
+	//size index, see the Size Index section
+	idx_bucket_t *idx_pool;	//buckets, in no order
+	word_t *idx_first;	//first size of every bucket in use, ascending
+	unsigned int *idx_map;	//the bucket in idx_pool of each entry of idx_first
+	unsigned int idx_buckets;	//in use
+	unsigned int idx_cap;	//buckets the three arrays have room for
+	unsigned int idx_free;	//a bucket of idx_pool not in use + 1, linked through node[0], 0: none
+	unsigned int idx_unused;	//idx_pool from here on has never been used
+	int idx_off;	//the index could not grow and is not kept until the arena is initialized again
+#endif
+
+	//quick lists, see the Quick Lists section
+	void *quick[QUICK_LISTS];	//freed blocks of one size each, still marked allocated, linked through their payload
+	unsigned short quick_count[QUICK_LISTS];
+	size_t quick_blocks;	//on all of them
+	size_t quick_bytes;
+	size_t quick_flushes;
+
+	//sampled integrity checks, see the Heap Checker section
+	unsigned int checks;	//operations since the last slice was checked
+	char *check_at;	//block the next slice starts at, NULL: the first one
+
+	slab_t *slab_partial[SLAB_CLASSES];	//per class list of slabs that are not full
+	size_t slab_map_hi;	//no bit at or above this page index is set
+	char *slab_base;	//page 0 of slab_map
+	unsigned char slab_map[SLAB_MAP_BITS / 8];	//one bit per heap page: is it a slab
+} arena_t;
+
+typedef struct{
+	void *head;	//linked through the first 8 bytes of each object
+	unsigned int count;
+} tcache_t;
+
+static arena_t main_arena = {.lock = PTHREAD_MUTEX_INITIALIZER};
+static arena_t *arenas[MM_ARENAS] = {&main_arena};
+static unsigned int narenas = 1;
+static unsigned int nthreads = 0;	//threads attached so far, arenas are handed out round robin
+static pthread_mutex_t arenas_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcache_key;	//only there for its destructor
+
+static __thread arena_t *arena;	//the arena being worked on, its lock is held
+static __thread arena_t *thread_arena;	//the arena this thread allocates from
+static __thread tcache_t tcache[SLAB_CLASSES];	//recently freed small objects of this thread
+static __thread int tcache_exiting;	//tcache_destroy has run, the cache is not to be filled again
+
+//large objects, see the Large Objects section
+#ifdef DRIVER
+#define MMAP_THRESHOLD	((size_t)-1)	//mdriver insists that every payload lies in the memlib heap
+#else
+#define MMAP_THRESHOLD	((size_t)128 << 10)	//initial threshold for a mapping of its own
+#endif
+#define MMAP_THRESHOLD_MAX	((size_t)32 << 20)	//the adaptive threshold never goes above this
+
+static size_t mmap_threshold = MMAP_THRESHOLD;
+static int mmap_threshold_fixed = 0;	//set by mm_set_mmap_threshold, the threshold stops adapting
+
+//returning memory to the system, see the Trimming and Scavenging section
+#ifdef MM_HUGE_PAGES
+#define HUGE_PAGE	((size_t)2 << 20)	//heaps grow to, and give back, whole transparent huge pages
+#define RELEASE_PAGE	HUGE_PAGE	//unit of the memory given back to the system
+#define TRIM_THRESHOLD	((size_t)4 << 20)
+#define TOP_PAD	HUGE_PAGE
+#define SCAVENGE_MIN	(HUGE_PAGE + LINK_BYTES)
+#else
+#define RELEASE_PAGE	PAGESIZE
+#define TRIM_THRESHOLD	((size_t)128 << 10)	//a free top block larger than this is trimmed
+#define TOP_PAD	((size_t)64 << 10)	//bytes an automatic trim leaves in the top block
+#define SCAVENGE_MIN	((size_t)64 << 10)	//smallest free block whose pages decay releases
+#endif
+#ifdef MM_TLSF
+#define DECAY_MS	0	//off: a scavenge walks every free block, in the middle of a free
+#else
+#define DECAY_MS	1000	//free pages are released at most this often, 0: never
+#endif
+#define DECAY_EVERY	256	//frees between two looks at the clock
+
+static size_t trim_threshold = TRIM_THRESHOLD;
+static size_t top_pad = TOP_PAD;
+static unsigned int decay_ms = DECAY_MS;
+
+//heap growth, see grow_heap
+#define GROW_SHIFT	3	//a heap grows by an eighth of its size
+#define GROW_SHIFT_TRIMMED	6	//or by a 64th right after a trim, back to an eighth over the next growths
+#define GROW_CAP	((size_t)16 << 20)	//default limit of a single growth
+
+static size_t grow_cap = GROW_CAP;
+
+static unsigned int quick_len = QUICK_LEN;	//blocks a quick list holds, 0: off
+
+//calls by size class, counted by every thread on its own, see the Statistics section
+typedef struct tstats{
+	size_t malloc_calls[MM_STAT_CLASSES];
+	size_t free_calls[MM_STAT_CLASSES];
+	size_t realloc_calls[MM_STAT_CLASSES];
+	struct tstats *next;	//threads attached to an arena, under arenas_lock
+	struct tstats *prev;
+} tstats_t;
+
+static tstats_t *tstats_list;
+static tstats_t tstats_exited;	//calls made by threads that are gone, under arenas_lock
+static __thread tstats_t tstats;
+static size_t mmapped_bytes;	//in mappings of large objects
+
+//sampled integrity checks, see the Heap Checker section
+static unsigned int check_every;	//operations of an arena between two slices, 0: off
+static unsigned int check_blocks;	//blocks in a slice
+static void (*check_fail)(int err, void *bp);	//called on corruption, NULL: abort
+
+//the sampling heap profiler, see the Heap Profiler section
+#define PROF_DEPTH	32	//frames kept of a stack
+#define PROF_RECHECK	((long)16 << 20)	//bytes a thread allocates between two looks at prof_rate while it is 0
+#define PROF_RATE_MAX	((size_t)1 << 40)
+#define PROF_TABLE_MIN	1024	//entries of a table when it is first mapped
+
+typedef struct{
+	size_t hash;	//of the frames, 0: an unused entry
+	unsigned int depth;
+	void *pc[PROF_DEPTH];	//return addresses, the caller of malloc first
+	size_t live_count;	//sampled blocks allocated from here and not freed yet
+	size_t live_bytes;
+	size_t alloc_count;	//all sampled allocations from here
+	size_t alloc_bytes;
+	size_t live_born;	//sum of prof_clock at the births of the live samples
+	size_t freed_count;	//sampled blocks from here that were freed
+	size_t freed_life;	//sum of their lifetimes, in prof_clock bytes
+} prof_stack_t;
+
+typedef struct{
+	void *bp;	//NULL: an unused entry
+	size_t size;	//asked for
+	size_t stack;	//in prof_stacks
+	size_t born;	//prof_clock when it was allocated
+} prof_sample_t;
+
+static pthread_mutex_t prof_lock = PTHREAD_MUTEX_INITIALIZER;	//guards the tables
+static size_t prof_rate;	//mean bytes between two samples, 0: off
+static prof_stack_t *prof_stacks;	//open addressing by hash with linear probes, NULL: none yet
+static size_t prof_stack_cap;	//a power of two
+static size_t prof_stack_count;
+static prof_sample_t *prof_samples;	//the same by address
+static size_t prof_sample_cap;
+static size_t prof_sample_count;
+static size_t prof_clock;	//bytes allocated by all threads since the profiler was turned on, prof_rate a sample
+static __thread long prof_left;	//bytes this thread allocates before the next sample
+static __thread unsigned long prof_seed;	//of the distances of this thread, 0: not seeded yet
+static __thread int prof_busy;	//the thread is in the profiler, its allocations are not recorded
 
 /******************************************************************************************************
  *                                               Macros                                               *
  ******************************************************************************************************/
 //CAUTION: unsigned instead of int should be used
 
-#define WSIZE	4	//word
-#define DSIZE	8	//double word
-#define QSIZE	16	//four words (minimum block size)
+#define WSIZE	((int)sizeof(word_t))	//word
+#define DSIZE	(2 * WSIZE)	//double word
+#define QSIZE	(4 * WSIZE)	//four words (minimum block size)
+#define BLOCK_MAX	((size_t)(word_t)~0x7)	//largest size a header can hold
 
-#define CHUNKSIZE	(1 << 9)	//extend heap by this amount (bytes), to be modified
+#define CHUNKSIZE	(1 << 9)	//initial heap size and smallest growth (bytes)
 
 #define MAX(x, y)	((x) > (y)? (x) : (y))
+#define MIN(x, y)	((x) < (y)? (x) : (y))
+
+//adjusted block size of a request: header plus alignment, at least QSIZE
+#define ASIZE(size)	(((size) <= 3 * WSIZE)? QSIZE : DSIZE * (((size) + (WSIZE) + (DSIZE - 1)) / DSIZE))
 
-#define PACK(size, alloc, prev_alloc)	((unsigned int)((size) | (alloc) | (prev_alloc << 1)))	
+#define PACK(size, alloc, prev_alloc)	((word_t)((size) | (alloc) | ((prev_alloc) << 1)))	
 					//prev_alloc: if the previous block is allocated
+#define CLEAN	0x4	//third last bit of a free block: every byte of it is zero but the header,
+			//the footer and the first LINK_BYTES, which hold the BST links
+#define LINK_BYTES	(4 * WSIZE)
+#define CLEAN_ABSORB	256	//a freed block up to this size is zeroed to merge into clean neighbours
 
 //address p
-#define GET(p)	(*(unsigned int *)(p))	
-#define PUT(p, val)	(*(unsigned int *)(p) = (unsigned int)(val))
-	//CAUTION: int type for 4 bytes; long type for 8 bytes, used for addr calcs,
+#define GET(p)	(*(word_t *)(p))	
+#define PUT(p, val)	(*(word_t *)(p) = (word_t)(val))
+	//CAUTION: word_t type for 4 (or 8) bytes; long type for 8 bytes, used for addr calcs,
 	//but long type should never be used to be put or got in the protocal defined here 
 	//(offset instead of addr)
 
 #define GET_SIZE(p)	(GET(p) & ~0x7)
 #define GET_ALLOC(p)	(GET(p) & 0x1)
 #define GET_PREV_ALLOC(p)	((GET(p) & 0x2) >> 1)
+#define GET_CLEAN(p)	(GET(p) & CLEAN)
 
 //Given block ptr bp, compute address of its header and footer
 #define HDRP(bp)	((char *)(bp) - WSIZE)
@@ -98,67 +461,324 @@ static void* free_listp = NULL;	//the root of the BST of free lists
 
 //for bst management;
 	//CAUTION: if the node has no child, its child-OFFSET instead of child-ADDRESS is 0
-#define GET_LCO(bp)	(GET(bp))	//left-child offset
-#define GET_RCO(bp)	(GET((char *)(bp) + WSIZE))
+	//next/prev link the free blocks of the same size; every free block has them
+	//lco/rco only exist in blocks larger than QSIZE
+#define GET_NCO(bp)	(GET(bp))	//next-in-chain offset
+#define GET_PCO(bp)	(GET((char *)(bp) + WSIZE))	//prev-in-chain offset, or TREE_TAG if bp is a tree node
+#define GET_LCO(bp)	(GET((char *)(bp) + 2 * WSIZE))	//left-child offset
+#define GET_RCO(bp)	(GET((char *)(bp) + 3 * WSIZE))
 
-#define PUT_LCO(bp, offset)	PUT((bp), offset)	//set left child offset
-#define PUT_RCO(bp, offset)	PUT(((char *)(bp) + WSIZE), offset)
+#define PUT_NCO(bp, offset)	PUT((bp), offset)	//set next-in-chain offset
+#define PUT_PCO(bp, offset)	PUT(((char *)(bp) + WSIZE), offset)
+#define PUT_LCO(bp, offset)	PUT(((char *)(bp) + 2 * WSIZE), offset)	//set left child offset
+#define PUT_RCO(bp, offset)	PUT(((char *)(bp) + 3 * WSIZE), offset)
 
-#define SET_PREV_ALLOC1(bp, val)	(PUT(HDRP(bp), PACK(GET_SIZE(HDRP(bp)), GET_ALLOC(HDRP(bp)), val)))
-#define SET_PREV_ALLOC2(bp, val)	(PUT(FTRP(bp), PACK(GET_SIZE(FTRP(bp)), GET_ALLOC(FTRP(bp)), val)))
+//a tree node keeps its AVL height in the prev slot; offsets are multiples of 8, so bit 0 tells them apart
+	//a chain member whose prev is 0 is the head of min_listp
+#ifdef MM_SCALED_OFFSETS	//every bit of a scaled offset counts, the tags are the top 256 values instead
+#define TREE_TAG(height)	(0xffffff00u | (height))
+#define IS_TREE_NODE(bp)	(GET_PCO(bp) >= TREE_TAG(0))
+#define TAG_HEIGHT(tag)	((tag) & 0xff)
+#else
+#define TREE_TAG(height)	(((height) << 1) | 1)
+#define IS_TREE_NODE(bp)	(GET_PCO(bp) & 0x1)
+#define TAG_HEIGHT(tag)	((tag) >> 1)
+#endif
+#define HEIGHT(offset)	((offset)? TAG_HEIGHT(GET_PCO(O2P(offset))) : 0)	//height of the subtree at offset
+
+#define SET_PREV_ALLOC1(bp, val)	(PUT(HDRP(bp), (GET(HDRP(bp)) & ~0x2) | ((val) << 1)))
+#define SET_PREV_ALLOC2(bp, val)	(PUT(FTRP(bp), (GET(FTRP(bp)) & ~0x2) | ((val) << 1)))
 #define SET_PREV_ALLOC(bp, val)		{SET_PREV_ALLOC1(bp, val); SET_PREV_ALLOC2(bp, val);}
 	//set prev-alloc bit without altering other infomation
 	//CAUTION: if bp points to a free block, SET_PREV_ALLOC should be called; otherwise, ALLOC1 should be called
 
-#define O2P(offset)	((void *)(heap_listp + offset))	//compute address, given offset
-#define P2O(addr)	((unsigned int)(addr - heap_listp))	//compute offset, given address
+//for small object slabs
+#define SLAB_HSIZE	32	//room for slab_t, keeps the objects aligned
+#define SLAB_COUNT(cls)	((PAGESIZE - WSIZE - SLAB_HSIZE) / slab_size[cls])	//objects per slab
+	//CAUTION: the last word of the page is the header of the next block
+#define SLAB_OF(bp)	((slab_t *)((size_t)(bp) & ~(size_t)(PAGESIZE - 1)))
+#define PAGE_INDEX(a, p)	((size_t)((char *)(p) - (a)->slab_base) / PAGESIZE)
+#define IS_SLAB(a, p)	((char *)(p) >= (a)->slab_base && PAGE_INDEX(a, p) < __atomic_load_n(&(a)->slab_map_hi, __ATOMIC_RELAXED) \
+				&& ((__atomic_load_n(&(a)->slab_map[PAGE_INDEX(a, p) >> 3], __ATOMIC_RELAXED) \
+					>> (PAGE_INDEX(a, p) & 0x7)) & 0x1))
+	//CAUTION: a is the arena that owns p, see arena_of; p's bit is stable while p is allocated,
+	//but other bits of its byte may change under a thread that does not hold a's lock
+#define SLAB_MAP_SET(slab)	__atomic_fetch_or(&arena->slab_map[PAGE_INDEX(arena, slab) >> 3], \
+					1 << (PAGE_INDEX(arena, slab) & 0x7), __ATOMIC_RELAXED)
+#define SLAB_MAP_CLEAR(slab)	__atomic_fetch_and(&arena->slab_map[PAGE_INDEX(arena, slab) >> 3], \
+					~(1 << (PAGE_INDEX(arena, slab) & 0x7)), __ATOMIC_RELAXED)
+
+#define ALIGN_UP(p, align)	(((size_t)(p) + ((align) - 1)) & ~((size_t)(align) - 1))
+#define ALIGN_PROBES	8	//free blocks tried by find_fit_aligned before it asks for a sure fit
+
+//for large objects
+#define MMAP_HSIZE	16	//mapping length (8 bytes), padding, then a header word of size 0
+#define MMAP_LEN(bp)	(*(size_t *)((char *)(bp) - MMAP_HSIZE))
+#define IS_MMAPPED(bp)	((__atomic_load_n((word_t *)HDRP(bp), __ATOMIC_RELAXED) & ~0x7) == 0)
+	//CAUTION: only for blocks that are not small objects, see IS_SLAB;
+	//a neighbour may change the prev-alloc bit of a heap block under us
+
+//for trimming and scavenging
+#ifdef MM_MADV_FREE
+#define MADV_RELEASE	MADV_FREE	//cheaper, but the pages are not known to be zero afterwards
+#else
+#define MADV_RELEASE	MADV_DONTNEED	//private anonymous pages read back as zero
+#endif
+#define ALIGN_DOWN(p, align)	((size_t)(p) & ~((size_t)(align) - 1))
+
+//for statistics
+#define STAT_CLASS(size)	(((size) <= SLAB_MAX)? slab_class[((size) + (ALIGNMENT - 1)) / ALIGNMENT] \
+				: MIN(SLAB_CLASSES + 55 - __builtin_clzl(size), MM_STAT_CLASSES - 1))
+#define STAT_CALLS(kind, cls, n)	__atomic_store_n(&tstats.kind[cls], tstats.kind[cls] + (n), __ATOMIC_RELAXED)
+#define STAT_CALL(kind, cls)	STAT_CALLS(kind, cls, 1)
+	//CAUTION: only the thread itself writes its counters, others read them while it runs
+
+//for the heap checker
+#define CHECK_TICK()	if(__atomic_load_n(&check_every, __ATOMIC_RELAXED) != 0) check_tick()
+#define CHECK_ABSORB(gone, into)	{if(arena->check_at == (char *)(gone)) arena->check_at = (char *)(into);}
+	//a block merged into another must not stay the start of the next slice
+
+//for the heap profiler
+#define SAMPLED	0x4	//third last bit of an allocated heap block or of the header word of a mapping:
+			//the profiler holds a sample of it (free blocks use the bit for CLEAN)
+#define IS_SAMPLED(bp)	(__atomic_load_n((word_t *)HDRP(bp), __ATOMIC_RELAXED) & SAMPLED)
+	//CAUTION: only for blocks that are not small objects, see IS_SLAB
+#define PROF_DUE(size)	(__builtin_expect((prof_left -= (long)(size)) < 0, 0) && prof_due())
+	//the only cost of the profiler to a malloc while it is off
+#define PROF_FREE(bp)	{if(IS_SAMPLED(bp)) prof_free(bp);}
+#define PROF_HASH(bp)	(((size_t)(bp) >> 4) * 0x9e3779b97f4a7c15ul >> 20)
+
+#define O2P(offset)	((void *)(arena->heap_listp + ((size_t)(offset) << OFFSET_SHIFT)))	//compute address, given offset
+#define P2O(addr)	((word_t)((size_t)((char *)(addr) - (char *)arena->heap_listp) >> OFFSET_SHIFT))	//compute offset, given address
 	//CAUTION: the reason why we do not provide a macro to get the address of the child of a given node
 		//is to avoid confusing errors that tries to manipulate a 0 offset
 
-/*NEW VERSION: Optimize the case when large number of malloc reqs of same size happens, otherwise the BST will
-	become a list and have terrible throughput. Our make-do solution is to use address comparison
-	to be a substitude of size comparison. Implementation with hash techneque. Better solution should 
-	maintain a list when same size.*/
-#define HASH(p)	((unsigned int)((((unsigned long)(p)) >> 3) & 1023))
-
 /******************************************************************************************************
  *                                        Function prototypes                                         *
  ******************************************************************************************************/
-int mm_init(void);
+INTERNAL int mm_init(void);
+static int arena_init(void);
+static void *arena_sbrk(size_t incr);
 static void *extend_heap(size_t words);
+static void *grow_heap(size_t asize);
 void free(void *bp);
+void free_sized(void *bp, size_t size);
+size_t malloc_usable_size(void *bp);
+static void tcache_put(void *bp, int cls);
+static void arena_free(void *bp);
+static void arena_free_run(void *bp, size_t size);
 static void *coalesce(void *bp);
-void bst_add(void *bp);
-void bst_delete(void *bp);
-void exit_from_error();
+static unsigned int clean_merge(char *prev, size_t psize, char *bp, size_t size, unsigned int clean,
+				char *next, size_t nsize);
+INTERNAL void bst_add(void *bp);
+INTERNAL void bst_delete(void *bp);
+static void chain_delete(void *bp);
+static word_t avl_insert(word_t root, void *bp, size_t size);
+static word_t avl_remove(word_t root, size_t size);
+static word_t avl_remove_min(word_t root, word_t *min);
+static word_t avl_balance(word_t root);
+static word_t avl_rotate_left(word_t root);
+static word_t avl_rotate_right(word_t root);
+static void avl_update(word_t root);
+INTERNAL void exit_from_error();
 void *malloc(size_t size);
+static void *arena_malloc(size_t size, unsigned int *clean);
 static void place(void *bp, size_t asize);
 static void *find_fit(size_t asize);
+static void *find_fit_aligned(size_t asize, size_t align);
+static void *aligned_pos(void *bp, size_t asize, size_t align);
+static void *place_aligned(void *bp, size_t asize, size_t align);
+static void *grow_heap_aligned(size_t asize, size_t align);
+#ifdef MM_SIZE_INDEX
+static void idx_reset(void);
+static void idx_release(void);
+static int idx_new_bucket(void);
+static unsigned int idx_bucket_of(size_t size);
+static unsigned int idx_rank(const idx_bucket_t *b, size_t size);
+static word_t idx_find(size_t asize);
+static word_t idx_exact(size_t size);
+static void idx_insert(size_t size, word_t node);
+static void idx_set(size_t size, word_t node);
+static void idx_remove(size_t size);
+static void idx_build(word_t root);
+static int idx_validate(void **where);
+static size_t count_nodes(word_t root);
+#endif
+#ifdef MM_TLSF
+static void tlsf_reset(void);
+static unsigned int tlsf_bin(size_t size);
+static void tlsf_insert(void *bp, size_t size);
+static void tlsf_remove(void *bp, size_t size);
+static void *tlsf_find(size_t asize);
+static void *tlsf_largest(void);
+static size_t tlsf_scavenge(size_t min);
+static int tlsf_check(size_t heap_blocks, size_t *blocks, size_t *bytes, void **where);
+#endif
+static void *slab_malloc(size_t size);
+static void slab_free(void *bp);
+static slab_t *slab_new(int cls);
+static void *slab_page(void);
+static void arena_lock(arena_t *a);
+static void arena_enter(arena_t *a);
+static void arena_unlock(void);
+static arena_t *arena_of(const void *bp);
+static arena_t *arena_attach(void);
+static arena_t *arena_create(void);
+static char *heap_reserve(size_t hsize);
+#ifdef MM_HUGE_PAGES
+static void huge_advise(char *lo, char *hi);
+#endif
+static void remote_push(arena_t *a, void *bp);
+static void *tcache_fill(int cls, size_t size);
+static void tcache_flush(int cls, unsigned int keep);
+static void tcache_destroy(void *unused);
+static void tcache_put_exiting(void *bp, int cls);
+static void tstats_fold(void);
+static void tcache_key_init(void);
+static void *mmap_malloc(size_t size);
+static void mmap_free(void *bp);
+static void *mmap_realloc(void *bp, size_t size);
+static int quick_put(void *bp, size_t size);
+static void quick_flush(unsigned int i);
+static void quick_flush_all(void);
+static size_t arena_trim(size_t pad);
+static size_t arena_scavenge(size_t min);
+static size_t scavenge_tree(word_t root, size_t min);
+static size_t scavenge_block(void *bp);
+static void decay_tick(void);
+static void tstats_add(tstats_t *to, const tstats_t *from);
+static void json_printf(char *buf, size_t len, size_t *pos, const char *fmt, ...);
 void *calloc(size_t nmemb, size_t size);
+int posix_memalign(void **memptr, size_t alignment, size_t size);
+void *aligned_alloc(size_t alignment, size_t size);
+void *memalign(size_t alignment, size_t size);
+void *valloc(size_t size);
+void *pvalloc(size_t size);
+static void *aligned_malloc(size_t align, size_t size);
+static void *place_tail(void *bp, size_t asize);
+static size_t carve(void *bp, size_t asize, size_t n, void **ptrs);
+static void *largest_free(void);
+static void sort_addr(void **ptrs, size_t n);
+static int pheap_rebuild(void);
+static void pheap_sync(void);
+static int prof_due(void);
+static long prof_distance(size_t rate);
+static void *prof_malloc(size_t size, const void *caller);
+static void prof_record(void *bp, size_t size, const void *caller);
+static void prof_free(void *bp);
+static size_t prof_stack_of(void **pc, unsigned int depth);
+static size_t prof_sample_slot(const void *bp);
+static void prof_sample_remove(size_t i);
+static int prof_grow_stacks(void);
+static int prof_grow_samples(void);
+static void prof_drop_all(void);
+static int prof_printf(int fd, char *buf, size_t *pos, const char *fmt, ...);
+static int prof_flush(int fd, char *buf, size_t *pos);
 void *realloc(void *oldptr, size_t size);
+void *reallocarray(void *oldptr, size_t nmemb, size_t size);
+static void *arena_realloc(void *bp, size_t size);
 static int in_heap(const void *p);
 static int aligned(const void *p);
-void mm_checkheap(int lineno);
-inline unsigned int hash(void* p);
+static int arena_validate(void **where);
+static int check_block(void *bp);
+static int check_links(void *bp);
+#ifndef MM_TLSF
+static int check_tree(word_t root, size_t lo, size_t hi, size_t *blocks, size_t *bytes);
+#endif
+static void *link_block(word_t offset);
+static void check_tick(void);
+INTERNAL void mm_checkheap(int lineno);
+INTERNAL void mm_checkheap_traverse(void *bp);
+INTERNAL void mm_checkheap_chain(word_t offset);
 
 /******************************************************************************************************
  *                                             Functions                                              *
  ******************************************************************************************************/
 /*********************************************************
  *    Initialize: return -1 on error, 0 on success.      *
+ * resets the main arena, other threads must be idle     *
  *********************************************************/
 int mm_init(void){	//checked
 	//printf("init called\n");
-	free_listp = NULL;
+	int ret;
+
+	if(thread_arena == NULL)
+		arena_attach();
+	memset(tcache, 0, sizeof(tcache));	//they point into the old heap
+
+	tstats_t *t;	//statistics start over with the heap
+	pthread_mutex_lock(&arenas_lock);
+	for(t = tstats_list; t != NULL; t = t->next)
+		memset(t, 0, offsetof(tstats_t, next));
+	memset(&tstats_exited, 0, sizeof(tstats_exited));
+	pthread_mutex_unlock(&arenas_lock);
+
+	pthread_mutex_lock(&main_arena.lock);
+	arena = &main_arena;
+	ret = arena_init();
+	pthread_mutex_unlock(&main_arena.lock);
+	return ret;
+}
+
+/*********************************************************
+ * arena_init - create the initial empty heap of the     *
+ * current arena: return -1 on error, 0 on success.      *
+ *********************************************************/
+static int arena_init(void){	//checked
+#ifndef DRIVER
+	if(arena->end == NULL){	//the main arena, there is no memlib: reserve its heap on first use
+		char *p = heap_reserve(0);
+
+		if(p == NULL)
+			return -1;
+		arena->lo = arena->fresh = p;
+		arena->end = p + ARENA_SIZE;
+	}
+#endif
+	arena->heap_listp = NULL;
+	arena->free_listp = NULL;
+	arena->min_listp = NULL;
+	memset(arena->slab_partial, 0, sizeof(arena->slab_partial));
+	memset(arena->slab_map, 0, (arena->slab_map_hi + 7) / 8);
+	arena->slab_map_hi = 0;
+	if(arena->end != NULL)	//drop everything, memlib is reset by its caller
+		arena->brk = arena->lo;
+#ifdef DRIVER
+	else{
+		arena->lo = mem_heap_lo();
+		arena->brk = (char *)mem_heap_hi() + 1;
+	}
+#endif
+	arena->frees = 0;
+	arena->scavenged_at = 0;
+	arena->grow_shift = GROW_SHIFT;
+	arena->sbrks = 0;
+	arena->free_bytes = arena->free_blocks = arena->splits = arena->fit_misses = 0;
+	memset(arena->coalesces, 0, sizeof(arena->coalesces));
+	memset(arena->fit_depth, 0, sizeof(arena->fit_depth));
+	memset(arena->quick, 0, sizeof(arena->quick));
+	memset(arena->quick_count, 0, sizeof(arena->quick_count));
+	arena->quick_blocks = arena->quick_bytes = arena->quick_flushes = 0;
+	arena->checks = 0;
+	arena->check_at = NULL;
+#ifdef MM_SIZE_INDEX
+	idx_reset();
+#endif
+#ifdef MM_TLSF
+	tlsf_reset();
+#endif
 
 	//create the initial empty heap
-	if((heap_listp = mem_sbrk(4 * WSIZE)) == (void *)-1)
+	char *bp;
+	if((bp = arena_sbrk(4 * WSIZE)) == (void *)-1)
 		return -1;
-	PUT(heap_listp, 0);	//alignment padding
-	PUT(heap_listp + (1 * WSIZE), PACK(DSIZE, 1, 1));	//prologue header
-	PUT(heap_listp + (2 * WSIZE), PACK(DSIZE, 1, 1));	//prologue footer
-	PUT(heap_listp + (3 * WSIZE), PACK(0, 1, 1));	//epilogue header
-	heap_listp += (2 * WSIZE);
+	PUT(bp, 0);	//alignment padding
+	PUT(bp + (1 * WSIZE), PACK(DSIZE, 1, 1));	//prologue header
+	PUT(bp + (2 * WSIZE), PACK(DSIZE, 1, 1));	//prologue footer
+	PUT(bp + (3 * WSIZE), PACK(0, 1, 1));	//epilogue header
+	arena->heap_listp = bp + (2 * WSIZE);
+	arena->touched = arena->heap_listp;
+	arena->slab_base = (char *)((size_t)arena->heap_listp & ~(size_t)(PAGESIZE - 1));
 
 	//extend the empty heap with a free block of CHUNKSIZE bytes
 	if(extend_heap(CHUNKSIZE / WSIZE) == NULL)
@@ -167,6 +787,47 @@ int mm_init(void){	//checked
 	return 0;
 }
 
+/*********************************************************
+ * arena_sbrk - mem_sbrk for the current arena           *
+ *********************************************************/
+static void *arena_sbrk(size_t incr){
+	char *old = arena->brk;
+
+	if(incr > HEAP_MAX - (size_t)(old - arena->lo)){	//offsets would not reach the new blocks
+		errno = ENOMEM;
+		return (void *)-1;
+	}
+	arena->sbrks++;
+#ifdef DRIVER
+	if(arena->end == NULL){	//main arena, memlib keeps what a trim gave back above brk
+		char *top = (char *)mem_heap_hi() + 1;
+#ifdef MM_HUGE_PAGES
+		char *from = top;
+#endif
+		while(old + incr > top){	//mem_sbrk takes an int
+			size_t step = MIN((size_t)(old + incr - top), (size_t)1 << 30);
+			if(mem_sbrk((int)step) == (void *)-1)
+				return (void *)-1;
+			top += step;
+		}
+		arena->lo = mem_heap_lo();
+#ifdef MM_HUGE_PAGES
+		if(top != from)	//the huge pages memlib has just reached, memlib's own reservation is not aligned
+			huge_advise(MAX((char *)ALIGN_DOWN(from, HUGE_PAGE), arena->lo), top);
+#endif
+	}
+	else
+#endif
+	if(incr > (size_t)(arena->end - old)){
+		errno = ENOMEM;
+		return (void *)-1;
+	}
+	arena->brk = old + incr;
+	if(arena->brk > arena->fresh)
+		arena->fresh = arena->brk;
+	return old;
+}
+
 /*********************************************************
  *                     extend heap                       *
  *********************************************************/
@@ -175,16 +836,18 @@ static void *extend_heap(size_t words){	//checked
 	//mm_checkheap(168);
 	char *bp;
 	size_t size;
+	char *fresh = arena->fresh;
 
 	//allocate an even number of words to maintain alignment
 	size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
-	if((long)(bp = mem_sbrk(size)) == -1)
+	if((long)(bp = arena_sbrk(size)) == -1)
 		return NULL;
 	//initialize free block header/footer and the epilogue header
 	int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+	unsigned int clean = (bp >= fresh)? CLEAN : 0;	//never handed out before: still zero
 	//printf("bp = %lu\n", (unsigned long)bp);
-	PUT(HDRP(bp), PACK(size, 0, prev_alloc));	//free block header
-	PUT(FTRP(bp), PACK(size, 0, prev_alloc));	//free block footer
+	PUT(HDRP(bp), PACK(size, 0, prev_alloc) | clean);	//free block header
+	PUT(FTRP(bp), PACK(size, 0, prev_alloc) | clean);	//free block footer
 	PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1, 0));	//new epilogue header
 
 	//mm_checkheap(183);
@@ -192,40 +855,122 @@ static void *extend_heap(size_t words){	//checked
 	return coalesce(bp);
 }
 
+/*********************************************************
+ * grow_heap - extend the heap for a block of asize      *
+ * bytes. It grows in proportion to its size, by at least*
+ * CHUNKSIZE and at most grow_cap bytes, and by less for *
+ * a while after a trim. Falls back to asize bytes when  *
+ * the full step cannot be had                           *
+ *********************************************************/
+static void *grow_heap(size_t asize){
+	size_t step = (size_t)(arena->brk - arena->lo) >> arena->grow_shift;
+	void *bp;
+
+	asize = MAX(asize, QSIZE);	//room for a free block
+	if(arena->grow_shift > GROW_SHIFT)
+		arena->grow_shift--;
+	step = MIN(MAX(step, CHUNKSIZE), __atomic_load_n(&grow_cap, __ATOMIC_RELAXED));
+	if(arena->grow_step != 0)
+		step = arena->grow_step;
+	step = ALIGN_UP(step, DSIZE);
+#ifdef MM_HUGE_PAGES
+	step = ALIGN_UP(arena->brk + MAX(step, asize), HUGE_PAGE) - (size_t)arena->brk;	//brk stays on a huge page boundary
+#endif
+	quick_flush_all();	//the top block may merge with some of them
+	if(step > asize && (bp = extend_heap(step / WSIZE)) != NULL)
+		return bp;
+	return extend_heap(asize / WSIZE);
+}
+
 /*********************************************************
  *                       malloc                          *
+ * small objects come from the thread cache, everything  *
+ * else from the thread's arena under its lock           *
  *********************************************************/
 void *malloc(size_t size){	//checked
 	//printf("malloc called, size = %u\n", (unsigned)size);
+	char *bp;
+	int cls = 0;
+
+	//like libc, a block of its own that may be passed to free
+	if(size == 0)
+		size = 1;
+	if(PROF_DUE(size))
+		return prof_malloc(size, __builtin_return_address(0));
+
+	STAT_CALL(malloc_calls, STAT_CLASS(size));
+	if(size <= SLAB_MAX){
+		cls = slab_class[(size + (ALIGNMENT - 1)) / ALIGNMENT];
+		if((bp = tcache[cls].head) != NULL){
+			tcache[cls].head = *(void **)bp;
+			tcache[cls].count--;
+			return bp;
+		}
+	}
+	else if(size >= __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED))
+		return mmap_malloc(size);
+
+	arena_lock((thread_arena != NULL)? thread_arena : arena_attach());
+	if(size <= SLAB_MAX)
+		bp = tcache_fill(cls, size);
+	else
+		bp = arena_malloc(size, NULL);
+	arena_unlock();
+	if(__builtin_expect(tcache_exiting, 0))
+		tstats_fold();
+	return bp;
+}
+
+/*********************************************************
+ * arena_malloc - malloc from the current arena, tell    *
+ * through clean (if not NULL) whether the block came    *
+ * from a clean free block                               *
+ *********************************************************/
+static void *arena_malloc(size_t size, unsigned int *clean){	//checked
 	//mm_checkheap(200);
 
 	size_t asize;	//adjusted block size
-	size_t extendsize;	//amount to extend heap if not fit
 	char* bp;
 	
-	if(heap_listp == NULL)
-        	mm_init();
-
-	//ignore spurious requests
-	if(size == 0)
+	if(arena->heap_listp == NULL && arena_init() == -1)
 		return NULL;
+	CHECK_TICK();
+
+	//small objects skip the BST, but slabs hold pointers and stay out of persistent heaps
+	if(clean != NULL)
+		*clean = 0;
+	if(size <= SLAB_MAX && arena->pheap == NULL && (bp = slab_malloc(size)) != NULL)
+		return bp;
 
 	//adjust block size to include overhead and alignment requires
-	if(size <= 3 * WSIZE)
-		asize = QSIZE;
-	else
-		asize = DSIZE * ((size + (WSIZE) + (DSIZE - 1)) / DSIZE);
+	if(size > BLOCK_MAX - QSIZE){	//no header can hold it
+		errno = ENOMEM;
+		return NULL;
+	}
+	asize = ASIZE(size);
+
+	//a block of exactly this size freed a moment ago
+	if(asize <= QUICK_MAX && (bp = arena->quick[asize / DSIZE]) != NULL){
+		arena->quick[asize / DSIZE] = *(void **)bp;
+		arena->quick_count[asize / DSIZE]--;
+		arena->quick_blocks--;
+		arena->quick_bytes -= asize;
+		return bp;
+	}
 
 	//search the free list for a fit
 	if((bp = find_fit(asize)) != NULL){
+		if(clean != NULL)
+			*clean = GET_CLEAN(HDRP(bp));
 		place(bp, asize);
 		return bp;
 	}
 	
 	//no fit found. get more memory and place the block
-	extendsize = MAX(asize, CHUNKSIZE);
-	if((bp = extend_heap(extendsize / WSIZE)) == NULL)
+	if((bp = grow_heap(asize)) == NULL)
 		return NULL;
+	if(clean != NULL)
+		*clean = GET_CLEAN(HDRP(bp));
 	place(bp, asize);
 
 	return bp;
@@ -233,22 +978,134 @@ void *malloc(size_t size){	//checked
 
 /*********************************************************
  *                        free                           *
+ * small objects go to the thread cache; a block of      *
+ * another arena whose lock is busy is left on that      *
+ * arena's remote list                                   *
  *********************************************************/
 void free(void *bp){
 	//printf("free called, bp = %lu\n", (unsigned long)bp);
 	if (bp == NULL) 
         	return;
 
-   	size_t size = GET_SIZE(HDRP(bp));
-	int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+	if(thread_arena == NULL)
+		arena_attach();
+
+	arena_t *owner = arena_of(bp);
+	if(IS_SLAB(owner, bp)){
+		tcache_put(bp, SLAB_OF(bp)->cls);
+		return;
+	}
+	PROF_FREE(bp);
+	if(IS_MMAPPED(bp)){
+		STAT_CALL(free_calls, STAT_CLASS(MMAP_LEN(bp) - MMAP_HSIZE));
+		mmap_free(bp);
+		return;
+	}
+	size_t size = (__atomic_load_n((word_t *)HDRP(bp), __ATOMIC_RELAXED) & ~0x7) - WSIZE;	//see IS_MMAPPED
+	STAT_CALL(free_calls, STAT_CLASS(size));
+
+	if(owner == thread_arena)
+		pthread_mutex_lock(&owner->lock);
+	else if(pthread_mutex_trylock(&owner->lock) != 0){
+		remote_push(owner, bp);
+		return;
+	}
+	arena_enter(owner);
+	arena_free(bp);
+	arena_unlock();
+	if(__builtin_expect(tcache_exiting, 0))
+		tstats_fold();
+}
+
+/*********************************************************
+ * free_sized - free with the size passed to the malloc  *
+ * that returned bp (or to the last realloc). A small    *
+ * object goes to the cache of the class of size without *
+ * a look at its slab, which realloc keeps in step       *
+ *********************************************************/
+void free_sized(void *bp, size_t size){
+	if(bp == NULL)
+		return;
+	if(size > SLAB_MAX){
+		free(bp);
+		return;
+	}
+
+	if(thread_arena == NULL)
+		arena_attach();
+	if(!IS_SLAB(arena_of(bp), bp)){	//aligned, or a heap block shrunk by realloc
+		free(bp);
+		return;
+	}
+	tcache_put(bp, slab_class[(size + (ALIGNMENT - 1)) / ALIGNMENT]);
+}
+
+/*********************************************************
+ * malloc_usable_size - the bytes of block bp that may   *
+ * be used, at least the size it was allocated with      *
+ *********************************************************/
+size_t malloc_usable_size(void *bp){
+	if(bp == NULL)
+		return 0;
+	if(IS_SLAB(arena_of(bp), bp))
+		return slab_size[SLAB_OF(bp)->cls];
+	if(IS_MMAPPED(bp))
+		return MMAP_LEN(bp) - MMAP_HSIZE;
+	return (__atomic_load_n((word_t *)HDRP(bp), __ATOMIC_RELAXED) & ~0x7) - WSIZE;	//see IS_MMAPPED
+}
+
+/*********************************************************
+ * tcache_put - put small object bp of class cls in the  *
+ * thread cache, give half of it back when it is full    *
+ *********************************************************/
+static void tcache_put(void *bp, int cls){
+	if(__builtin_expect(tcache_exiting, 0)){
+		tcache_put_exiting(bp, cls);
+		return;
+	}
+	STAT_CALL(free_calls, cls);
+	if(tcache[cls].count == TCACHE_MAX)
+		tcache_flush(cls, TCACHE_MAX / 2);
+	*(void **)bp = tcache[cls].head;
+	tcache[cls].head = bp;
+	tcache[cls].count++;
+}
+
+/*********************************************************
+ * arena_free - free to the current arena, a small heap  *
+ * block goes to its quick list                          *
+ *********************************************************/
+static void arena_free(void *bp){
+	if(IS_SLAB(arena, bp)){
+		slab_free(bp);
+		return;
+	}
+	size_t size = GET_SIZE(HDRP(bp));
+	if(GET(HDRP(bp)) & SAMPLED)	//the quick lists keep the header
+		PUT(HDRP(bp), GET(HDRP(bp)) & ~SAMPLED);
+	if(size <= QUICK_MAX && arena->pheap == NULL && quick_put(bp, size))	//the lists link through pointers
+		return;
+	arena_free_run(bp, size);
+}
 
-	if(heap_listp == 0){
-        	mm_init();
-   	}
+/*********************************************************
+ * arena_free_run - free the size bytes of allocated     *
+ * blocks from bp on as one block                        *
+ *********************************************************/
+static void arena_free_run(void *bp, size_t size){
+	int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
 
 	PUT(HDRP(bp), PACK(size, 0, prev_alloc));
 	PUT(FTRP(bp), PACK(size, 0, prev_alloc));
-	coalesce(bp);	
+	bp = coalesce(bp);
+	CHECK_TICK();	//not before: the blocks of a run from mm_free_batch are one only now
+
+	//give a large top block back, now and then release the pages of large free blocks
+	size_t threshold = __atomic_load_n(&trim_threshold, __ATOMIC_RELAXED);
+	if(threshold != 0 && GET_SIZE(HDRP(NEXT_BLKP(bp))) == 0 && GET_SIZE(HDRP(bp)) > threshold)
+		arena_trim(__atomic_load_n(&top_pad, __ATOMIC_RELAXED));
+	if(++arena->frees == DECAY_EVERY)
+		decay_tick();
 }
 
 /*********************************************************
@@ -261,104 +1118,143 @@ static void *coalesce(void *bp){	//checked
 	size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
 	size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
 	size_t size = GET_SIZE(HDRP(bp));
+	size_t psize = 0, nsize = 0;	//sizes of the free neighbours merged into bp
+	char *prev = NULL;
+	char *next = NEXT_BLKP(bp);
 	void *next_blkp_after = NEXT_BLKP(bp); //point to the next block after coalesce		
+	unsigned int clean = GET_CLEAN(HDRP(bp));
+
+#ifdef MM_SCALED_OFFSETS
+	//the heap may outgrow a header: a neighbour too large to merge with is left alone, free as it is
+	if(!prev_alloc && GET_SIZE(HDRP(PREV_BLKP(bp))) + size > BLOCK_MAX)
+		prev_alloc = 1;
+	if(!next_alloc && GET_SIZE(HDRP(next)) + size + (prev_alloc? 0 : GET_SIZE(HDRP(PREV_BLKP(bp)))) > BLOCK_MAX)
+		next_alloc = 1;
+#endif
 	
-	//case 1
-	if(prev_alloc && next_alloc){	
-		PUT(HDRP(bp), PACK(size, 0, 1));
-		PUT(FTRP(bp), PACK(size, 0, 1));
-		bst_add(bp);	//add to free-list-BST
-	}
-	
+	//case 1: nothing to merge
+	arena->coalesces[(!prev_alloc << 1) | !next_alloc]++;	//0: case 1, 1: case 2, 2: case 3, 3: case 4
+
 	//case 2
-	else if(prev_alloc && !next_alloc){
-		bst_delete(NEXT_BLKP(bp));
-		next_blkp_after = NEXT_BLKP(NEXT_BLKP(bp));
-		size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
-		PUT(HDRP(bp), PACK(size, 0, 1));
-		PUT(FTRP(bp), PACK(size, 0, 1));
-		bst_add(bp);
+	if(prev_alloc && !next_alloc){
+		bst_delete(next);
+		nsize = GET_SIZE(HDRP(next));
+		next_blkp_after = NEXT_BLKP(next);
 	}
 
 	//case 3
 	else if(!prev_alloc && next_alloc){
-		bst_delete(PREV_BLKP(bp));
-		size += GET_SIZE(HDRP(PREV_BLKP(bp)));
-		PUT(FTRP(bp), PACK(size, 0, 1));
-		PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0, 1));
-		bp = PREV_BLKP(bp);
-		bst_add(bp);
+		prev = PREV_BLKP(bp);
+		bst_delete(prev);
+		psize = GET_SIZE(HDRP(prev));
 	}
 
 	//case 4
-	else{
-		bst_delete(PREV_BLKP(bp));
-		bst_delete(NEXT_BLKP(bp));		
-		next_blkp_after = NEXT_BLKP(NEXT_BLKP(bp));		
-		size += GET_SIZE(HDRP(PREV_BLKP(bp)))
-			+ GET_SIZE(FTRP(NEXT_BLKP(bp)));
-		PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0, 1));
-		PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0, 1));
-		bp = PREV_BLKP(bp);
-		bst_add(bp);
+	else if(!prev_alloc && !next_alloc){
+		prev = PREV_BLKP(bp);
+		bst_delete(prev);
+		bst_delete(next);		
+		psize = GET_SIZE(HDRP(prev));
+		nsize = GET_SIZE(HDRP(next));
+		next_blkp_after = NEXT_BLKP(next);		
 	}
+
+	//CAUTION: clean_merge may zero the headers, footers and links between the parts
+	if(psize != 0 || nsize != 0)
+		clean = clean_merge(prev, psize, bp, size, clean, next, nsize);
+	if(nsize != 0)
+		CHECK_ABSORB(next, (prev != NULL)? prev : bp);
+	if(prev != NULL){
+		CHECK_ABSORB(bp, prev);
+		bp = prev;
+	}
+	size += psize + nsize;
+#ifdef MM_SCALED_OFFSETS
+	PUT(HDRP(bp), PACK(size, 0, GET_PREV_ALLOC(HDRP(bp))) | clean);
+	PUT(FTRP(bp), GET(HDRP(bp)));
+	bst_add(bp);	//add to free-list-BST
+
+	if(GET_ALLOC(HDRP(next_blkp_after)))
+		SET_PREV_ALLOC1(next_blkp_after, 0);
+	else
+		SET_PREV_ALLOC(next_blkp_after, 0);
+#else
+	PUT(HDRP(bp), PACK(size, 0, 1) | clean);
+	PUT(FTRP(bp), PACK(size, 0, 1) | clean);
+	bst_add(bp);	//add to free-list-BST
 	
 	SET_PREV_ALLOC1(next_blkp_after, 0);	//maintain the prev-alloc bit
+#endif
 	//mm_checkheap(300);
 	return bp;
 }
 
+/*********************************************************
+ * clean_merge - whether the block merged from bp and    *
+ * its free neighbours prev and next (NULL/0 when not    *
+ * merged) is clean. It is when every part is, after     *
+ * zeroing the words at the joints; a dirty bp of at     *
+ * most CLEAN_ABSORB bytes is zeroed to get there.       *
+ *********************************************************/
+static unsigned int clean_merge(char *prev, size_t psize, char *bp, size_t size, unsigned int clean,
+				char *next, size_t nsize){
+	if((psize != 0 && !GET_CLEAN(HDRP(prev))) || (nsize != 0 && !GET_CLEAN(HDRP(next))))
+		return 0;
+	if(!clean){
+		if(size > CLEAN_ABSORB)
+			return 0;
+		memset(bp, 0, size - WSIZE);
+	}
+
+	if(psize != 0)	//footer of prev, header and links of bp
+		memset(prev + psize - DSIZE, 0, DSIZE + MIN(LINK_BYTES, size - DSIZE));
+	if(nsize != 0)	//footer of bp, header and links of next
+		memset(bp + size - DSIZE, 0, DSIZE + MIN(LINK_BYTES, nsize - DSIZE));
+	return CLEAN;
+}
+
 /*********************************************************
  *                     bst_add                           *
  * add new free block to the BST of free blocks          *  
+ * a block whose size already has a tree node is pushed  *
+ * onto that node's chain instead of becoming a new node *
  *********************************************************/
 void bst_add(void *bp){	//checked
 	//printf("bst_add called: bp = %lu\n", (unsigned long)bp);
 	//mm_checkheap(310);
 
-	//case1: empty tree now
-	if(free_listp == NULL){
-		free_listp = bp;
-		PUT_LCO(bp, 0);
-		PUT_RCO(bp, 0);
-		return;
-	}
-	
-	//case2: not empty
 	size_t size = GET_SIZE(HDRP(bp));
-	void *root = free_listp;
-	int lr_flag = 0;	//0 for left-child, 1 for right-child
 
-	//search the parent of bp
-	while(1){
-		size_t root_size = GET_SIZE(HDRP(root));
-		if((size < root_size) || ((size == root_size) && (HASH(bp) <= HASH(root)))){	
-				// <=: true, <: false! consider deleting
-		//if(size <= root_size){
-			if(GET_LCO(root) == 0)
-				break;
-			root = heap_listp + GET_LCO(root);
-			continue;
-		}
-		else{
-			if(GET_RCO(root) == 0){
-				lr_flag = 1;
-				break;
-			}
-			root = heap_listp + GET_RCO(root);
-			continue;
-		}
+	arena->free_bytes += size;
+	arena->free_blocks++;
+#ifdef MM_TLSF
+	tlsf_insert(bp, size);
+	return;
+#endif
+
+	//case1: minimum block, no room for child offsets
+	if(size == QSIZE){
+		PUT_NCO(bp, ((arena->min_listp == NULL)? 0 : P2O(arena->min_listp)));
+		PUT_PCO(bp, 0);
+		if(arena->min_listp != NULL)
+			PUT_PCO(arena->min_listp, P2O(bp));
+		arena->min_listp = bp;
+		return;
 	}
-	
-	//found: now root point to bp's parent
-	if(lr_flag)	//bp is the right child of the root
-		PUT_RCO(root, ((unsigned int)(bp - heap_listp)));
-	else	//left
-		PUT_LCO(root, ((unsigned int)(bp - heap_listp)));
 
-	//set bp's lco & rco
-	PUT_LCO(bp, 0);
-	PUT_RCO(bp, 0);
+	//case2: insert into the AVL tree (or the chain of an existing node)
+#ifdef MM_SIZE_INDEX
+	word_t node;
+	if(!arena->idx_off && (node = idx_exact(size)) != 0){	//the index knows the node, no walk down the tree
+		avl_insert(node, bp, size);
+		return;
+	}
+#endif
+	word_t root = (arena->free_listp == NULL)? 0 : P2O(arena->free_listp);
+	arena->free_listp = O2P(avl_insert(root, bp, size));
+#ifdef MM_SIZE_INDEX
+	idx_insert(size, P2O(bp));	//a new size, bp is its tree node
+#endif
 
 	//mm_checkheap(354);
 	return;
@@ -375,89 +1271,220 @@ void bst_delete(void *bp){	//checked
 	if(bp == NULL)
 		return;
 
-	//case1: empty tree now
-	if(free_listp == NULL){
+	arena->free_bytes -= GET_SIZE(HDRP(bp));
+	arena->free_blocks--;
+#ifdef MM_TLSF
+	tlsf_remove(bp, GET_SIZE(HDRP(bp)));
+	return;
+#endif
+
+	//case1: a chain member (including every block of min_listp), O(1)
+	if(!IS_TREE_NODE(bp)){
+		chain_delete(bp);
+		return;
+	}
+
+	//case2: empty tree now
+	if(arena->free_listp == NULL){
 		printf("ERROR: try to delete a node from an empty BST! %lx\n", (unsigned long)bp);
 		exit_from_error();
 	}
-	
-	//case2: not empty
+
 	size_t size = GET_SIZE(HDRP(bp));
-	void *root = free_listp;
-
-	//search the parent of bp
-	int root_flag = 0;	//1: if bp is the root of the BST
-	int lr_flag = 0;	//0 for left-child, 1 for right-child
-
-	if(bp == root)	//special case: bp is the root
-		root_flag = 1;
-	else{	
-		while(1){
-			size_t root_size = GET_SIZE(HDRP(root));
-			if((size < root_size) || ((size == root_size) && (HASH(bp) <= HASH(root)))){
-			//if(size <= root_size){
-				if(GET_LCO(root) == ((unsigned int)(bp - heap_listp)))
-					break;
-				if(GET_LCO(root) == 0){
-					printf("ERROR: try to delete a non-existing node! %lx\n", (unsigned long)bp);
-					exit_from_error();
-				}
-				root = heap_listp + GET_LCO(root);
-				continue;
-			}
-			else{
-				if(GET_RCO(root) == ((unsigned int)(bp - heap_listp))){
-					lr_flag = 1;
-					break;
-				}
-				if(GET_RCO(root) == 0){
-					printf("ERROR: try to delete a non-existing node! %lu\n", (unsigned long)bp);
-					exit_from_error();
-				}
-				root = heap_listp + GET_RCO(root);
-				continue;
-			}
-		}
+
+	//case3: a tree node with no other block of its size, rebalance on the way up
+	if(GET_NCO(bp) == 0){
+		word_t root = avl_remove(P2O(arena->free_listp), size);
+		arena->free_listp = (root == 0)? NULL : O2P(root);
+#ifdef MM_SIZE_INDEX
+		idx_remove(size);
+#endif
+		return;
 	}
 
-	//found: now root point to bp's parent if not root_flag
-	//the following code takes text book 'Data Structure and Algorithm' (page 119: BST delete) as reference
-	unsigned int temppointer;	//offset: the node to replace bp
-	unsigned int tempparent = 0;	//offset: the parent of temppointer
-	unsigned int parent = root - heap_listp;	//offset: the parent to bp, if not root_flag
-	unsigned int pointer = bp - heap_listp;	//offset: bp
+	//case4: a tree node with a chain, its first chain member takes its place in the tree
+	void *succ = O2P(GET_NCO(bp));
+	PUT_NCO(bp, GET_NCO(succ));	//unlink succ from the chain first
+	if(GET_NCO(succ) != 0)
+		PUT_PCO(O2P(GET_NCO(succ)), P2O(bp));
+	PUT_PCO(succ, GET_PCO(bp));	//then copy the node, its shape is unchanged
+	PUT_LCO(succ, GET_LCO(bp));
+	PUT_RCO(succ, GET_RCO(bp));
+	PUT_NCO(succ, GET_NCO(bp));
+	if(GET_NCO(bp) != 0)
+		PUT_PCO(O2P(GET_NCO(bp)), P2O(succ));
+#ifdef MM_SIZE_INDEX
+	idx_set(size, P2O(succ));
+#endif
 
-	if(GET_LCO(bp) == 0){	//if the left tree of the node to be delete is empty
-		temppointer = GET_RCO(bp);
+	//search the parent of bp, the key is unique
+	if(bp == arena->free_listp){
+		arena->free_listp = succ;
+		return;
 	}
-	else{	//search for the maximum node as the node to replace the node to be delete		
-		temppointer = GET_LCO(bp);
-		while(GET_RCO(O2P(temppointer)) != 0){
-			tempparent = temppointer;
-			temppointer = GET_RCO(O2P(temppointer));	//descend from right
+	void *root = arena->free_listp;
+	while(1){
+		size_t root_size = GET_SIZE(HDRP(root));
+		if(size < root_size){
+			if(GET_LCO(root) == P2O(bp)){
+				PUT_LCO(root, P2O(succ));
+				break;
+			}
+			if(GET_LCO(root) == 0){
+				printf("ERROR: try to delete a non-existing node! %lx\n", (unsigned long)bp);
+				exit_from_error();
+			}
+			root = O2P(GET_LCO(root));
+		}
+		else{
+			if(GET_RCO(root) == P2O(bp)){
+				PUT_RCO(root, P2O(succ));
+				break;
+			}
+			if(GET_RCO(root) == 0){
+				printf("ERROR: try to delete a non-existing node! %lx\n", (unsigned long)bp);
+				exit_from_error();
+			}
+			root = O2P(GET_RCO(root));
 		}
-		if(tempparent == 0)	//if the node to replace bp is its left child
-			PUT_LCO(O2P(pointer), GET_LCO(O2P(temppointer)));
-		else
-			PUT_RCO(O2P(tempparent), GET_LCO(O2P(temppointer)));
-		PUT_LCO(O2P(temppointer), GET_LCO(O2P(pointer)));
-		PUT_RCO(O2P(temppointer), GET_RCO(O2P(pointer)));
 	}
 
-	//replace the node to be delete (bp) by the node to replace bp (temppointer)
-	if(root_flag == 1){
-		if(temppointer == 0)
-			free_listp = NULL;
-		else
-			free_listp = O2P(temppointer);
+	//mm_checkheap(449);
+	return;
+}
+
+/*********************************************************
+ *                    chain_delete                       *
+ * unlink a block that is not a tree node from its chain *
+ *********************************************************/
+static void chain_delete(void *bp){
+	word_t next = GET_NCO(bp);
+	word_t prev = GET_PCO(bp);
+
+	if(prev == 0)	//head of min_listp
+		arena->min_listp = (next == 0)? NULL : O2P(next);
+	else	//prev is either the tree node or another chain member, next sits at the same slot in both
+		PUT_NCO(O2P(prev), next);
+	if(next != 0)
+		PUT_PCO(O2P(next), prev);
+}
+
+/*********************************************************
+ *                     avl helpers                       *
+ * all of them work on offsets and return the offset of  *
+ * the new root of the subtree they were given           *
+ * the following code takes text book 'Data Structure    *
+ * and Algorithm' (AVL tree) as reference                *
+ *********************************************************/
+static word_t avl_insert(word_t root, void *bp, size_t size){
+	if(root == 0){	//new tree node
+		PUT_NCO(bp, 0);
+		PUT_PCO(bp, TREE_TAG(1));
+		PUT_LCO(bp, 0);
+		PUT_RCO(bp, 0);
+		return P2O(bp);
 	}
-	else if(lr_flag == 0)
-		PUT_LCO(O2P(parent), temppointer);
+
+	void *rp = O2P(root);
+	size_t root_size = GET_SIZE(HDRP(rp));
+	if(size == root_size){	//same size: push right behind the tree node, the tree is unchanged
+		PUT_NCO(bp, GET_NCO(rp));
+		PUT_PCO(bp, root);
+		if(GET_NCO(rp) != 0)
+			PUT_PCO(O2P(GET_NCO(rp)), P2O(bp));
+		PUT_NCO(rp, P2O(bp));
+		return root;
+	}
+	if(size < root_size)
+		PUT_LCO(rp, avl_insert(GET_LCO(rp), bp, size));
 	else
-		PUT_RCO(O2P(parent), temppointer);
+		PUT_RCO(rp, avl_insert(GET_RCO(rp), bp, size));
+	return avl_balance(root);
+}
 
-	//mm_checkheap(449);
-	return;
+static word_t avl_remove(word_t root, size_t size){
+	if(root == 0){
+		printf("ERROR: try to delete a non-existing node! size = %lu\n", (unsigned long)size);
+		exit_from_error();
+	}
+
+	void *rp = O2P(root);
+	size_t root_size = GET_SIZE(HDRP(rp));
+	if(size < root_size)
+		PUT_LCO(rp, avl_remove(GET_LCO(rp), size));
+	else if(size > root_size)
+		PUT_RCO(rp, avl_remove(GET_RCO(rp), size));
+	else{	//found: replace it by the minimum node of its right tree
+		word_t min;
+		if(GET_LCO(rp) == 0)
+			return GET_RCO(rp);
+		if(GET_RCO(rp) == 0)
+			return GET_LCO(rp);
+		word_t right = avl_remove_min(GET_RCO(rp), &min);
+		PUT_LCO(O2P(min), GET_LCO(rp));
+		PUT_RCO(O2P(min), right);
+		root = min;
+	}
+	return avl_balance(root);
+}
+
+static word_t avl_remove_min(word_t root, word_t *min){
+	void *rp = O2P(root);
+	if(GET_LCO(rp) == 0){
+		*min = root;
+		return GET_RCO(rp);
+	}
+	PUT_LCO(rp, avl_remove_min(GET_LCO(rp), min));
+	return avl_balance(root);
+}
+
+static word_t avl_balance(word_t root){
+	void *rp = O2P(root);
+	word_t left = GET_LCO(rp);
+	word_t right = GET_RCO(rp);
+	int diff = (int)HEIGHT(left) - (int)HEIGHT(right);
+
+	if(diff > 1){	//left heavy
+		if(HEIGHT(GET_LCO(O2P(left))) < HEIGHT(GET_RCO(O2P(left))))
+			PUT_LCO(rp, avl_rotate_left(left));
+		return avl_rotate_right(root);
+	}
+	if(diff < -1){	//right heavy
+		if(HEIGHT(GET_RCO(O2P(right))) < HEIGHT(GET_LCO(O2P(right))))
+			PUT_RCO(rp, avl_rotate_right(right));
+		return avl_rotate_left(root);
+	}
+	avl_update(root);
+	return root;
+}
+
+static word_t avl_rotate_left(word_t root){
+	void *rp = O2P(root);
+	word_t right = GET_RCO(rp);
+	void *np = O2P(right);
+
+	PUT_RCO(rp, GET_LCO(np));
+	PUT_LCO(np, root);
+	avl_update(root);
+	avl_update(right);
+	return right;
+}
+
+static word_t avl_rotate_right(word_t root){
+	void *rp = O2P(root);
+	word_t left = GET_LCO(rp);
+	void *np = O2P(left);
+
+	PUT_LCO(rp, GET_RCO(np));
+	PUT_RCO(np, root);
+	avl_update(root);
+	avl_update(left);
+	return left;
+}
+
+static void avl_update(word_t root){
+	void *rp = O2P(root);
+	PUT_PCO(rp, TREE_TAG(1 + MAX(HEIGHT(GET_LCO(rp)), HEIGHT(GET_RCO(rp)))));
 }
 
 /*********************************************************
@@ -470,21 +1497,26 @@ static void place(void *bp, size_t asize){	//checked
 	//mm_checkheap(460);
 
 	size_t csize = GET_SIZE(HDRP(bp));
+	int prev_alloc = GET_PREV_ALLOC(HDRP(bp));	//free only next to a block too large to merge with
+	unsigned int clean = GET_CLEAN(HDRP(bp));	//the remainder stays clean
 	bst_delete(bp);
 	
-	unsigned int dif = (long unsigned)csize - (long unsigned)asize;
+	size_t dif = csize - asize;
 	if(dif >= QSIZE){	//enough for split
-		PUT(HDRP(bp), PACK(asize, 1, 1));
+		arena->splits++;
+		PUT(HDRP(bp), PACK(asize, 1, prev_alloc));
 		bp = NEXT_BLKP(bp);
-		PUT(HDRP(bp), PACK(csize - asize, 0, 1));
-		PUT(FTRP(bp), PACK(csize - asize, 0, 1));
+		PUT(HDRP(bp), PACK(csize - asize, 0, 1) | clean);
+		PUT(FTRP(bp), PACK(csize - asize, 0, 1) | clean);
 		bst_add(bp);
 	}
 	else{	//not enough for split
-		PUT(HDRP(bp), PACK(csize, 1, 1));
+		PUT(HDRP(bp), PACK(csize, 1, prev_alloc));
 		bp = NEXT_BLKP(bp);
 		SET_PREV_ALLOC1(bp, 1);
 	}
+	if((char *)bp > arena->touched)	//bp is right after the block handed out
+		arena->touched = bp;
 
 	//mm_checkheap(479);
 	return;
@@ -497,28 +1529,68 @@ static void *find_fit(size_t asize){	//checked
 	//printf("find_fit called, asize = %u\n", (unsigned)asize);
 	//mm_checkheap(488);
 
-	void *bp = free_listp;
-	void *candidate = NULL;
-	
-	//search for the best fit block
-	while(bp != NULL){
-		size_t bpsize = GET_SIZE(HDRP(bp));
-		if(bpsize == asize){	//perfectly fit
-			candidate = bp;
-			break;
+	void *bp;
+	void *candidate;
+	unsigned int depth;	//nodes visited
+
+	for(;;){
+		//the minimum size is never in the tree
+		if(asize == QSIZE && arena->min_listp != NULL)
+			return arena->min_listp;
+
+		bp = arena->free_listp;
+		candidate = NULL;
+		depth = 0;
+#ifdef MM_SIZE_INDEX
+		if(!arena->idx_off){	//the index has the best fit, the tree is not walked
+			word_t node = idx_find(asize);
+			candidate = (node == 0)? NULL : O2P(node);
+			depth = 1;
+			bp = NULL;
 		}
-		else if(bpsize < asize){	//not enough
-			if(GET_RCO(bp) == 0)
+#endif
+#ifdef MM_TLSF
+		candidate = tlsf_find(asize);
+		depth = 1;
+		bp = NULL;
+#endif
+
+		//search for the best fit block
+		while(bp != NULL){
+			depth++;
+			size_t bpsize = GET_SIZE(HDRP(bp));
+			if(bpsize == asize){	//perfectly fit
+				candidate = bp;
 				break;
-			bp = O2P(GET_RCO(bp));
-			continue;
+			}
+			else if(bpsize < asize){	//not enough
+				if(GET_RCO(bp) == 0)
+					break;
+				bp = O2P(GET_RCO(bp));
+				continue;
+			}
+			//enough
+			candidate = bp;
+			if(GET_LCO(bp) == 0)
+				break;
+			bp = O2P(GET_LCO(bp));
 		}
-		//enough
-		candidate = bp;
-		if(GET_LCO(bp) == 0)
+
+		if(candidate != NULL || arena->quick_blocks == 0)
 			break;
-		bp = O2P(GET_LCO(bp));
+		quick_flush_all();	//merge the deferred frees, then look again
 	}
+
+	//one search counted, however often it looked
+	arena->fit_depth[MIN(depth, MM_STAT_DEPTHS - 1)]++;
+	if(candidate == NULL)
+		arena->fit_misses++;
+
+#ifndef MM_TLSF
+	//prefer a chain member of the best size, it leaves the tree untouched
+	if(candidate != NULL && GET_NCO(candidate) != 0)
+		candidate = O2P(GET_NCO(candidate));
+#endif
 	
 	//now candidate point to the best fit block if not NULL
 	//mm_checkheap(514);
@@ -526,141 +1598,3204 @@ static void *find_fit(size_t asize){	//checked
 }
 
 /*********************************************************
- * realloc - Change the size of the block by mallocing a *
- * new block, copying its data, and freeing the old block*
+ * find_fit_aligned - Find a free block that can hold an *
+ * allocated block of asize bytes whose payload is       *
+ * aligned to align, leaving either no leading slack or  *
+ * enough for a free block                               *
  *********************************************************/
-void *realloc(void *oldptr, size_t size){
-	//printf("realloc called, oldptr = %lu, size = %u\n", (unsigned long)oldptr, (unsigned)size);	
+static void *find_fit_aligned(size_t asize, size_t align){
+	size_t need = asize;
+	int probes = 0;
+	void *bp;
 
-	size_t oldsize;
-	void *newptr;
+	//try the best fit sizes first, walking the whole chain of each size
+	while(probes < ALIGN_PROBES && (bp = find_fit(need)) != NULL){
+#ifndef MM_TLSF
+		if(!IS_TREE_NODE(bp) && GET_PCO(bp) != 0)	//start from the tree node of this size
+			bp = O2P(GET_PCO(bp));
+#endif
+		need = GET_SIZE(HDRP(bp)) + DSIZE;
+		while(probes++ < ALIGN_PROBES){
+			if(aligned_pos(bp, asize, align) != NULL)
+				return bp;
+			if(GET_NCO(bp) == 0)
+				break;
+			bp = O2P(GET_NCO(bp));
+		}
+	}
 
-	/* If size == 0 then this is just free, and we return NULL. */
-	if(size == 0){
-		free(oldptr);
-		return 0;
+	//any block this large always fits
+	return find_fit(asize + align + QSIZE);
+}
+
+/*********************************************************
+ * aligned_pos - the first payload address in free block *
+ * bp aligned to align for a block of asize bytes, or    *
+ * NULL if there is none                                 *
+ *********************************************************/
+static void *aligned_pos(void *bp, size_t asize, size_t align){
+	char *abp = (char *)ALIGN_UP(bp, align);
+
+	while(abp != (char *)bp && abp - (char *)bp < QSIZE)	//leading slack too small for a free block
+		abp += align;
+	if(abp + asize > (char *)bp + GET_SIZE(HDRP(bp)))
+		return NULL;
+	return abp;
+}
+
+/*********************************************************
+ * place_aligned - Place block of asize bytes at the     *
+ * first aligned position of free block bp, the leading  *
+ * and trailing slack go back to the BST                 *
+ *********************************************************/
+static void *place_aligned(void *bp, size_t asize, size_t align){
+	size_t csize = GET_SIZE(HDRP(bp));
+	int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+	unsigned int clean = GET_CLEAN(HDRP(bp));	//the slack stays clean
+	char *abp = aligned_pos(bp, asize, align);
+	size_t lead = abp - (char *)bp;
+
+	bst_delete(bp);
+
+	//leading slack
+	if(lead != 0){
+		arena->splits++;
+		PUT(HDRP(bp), PACK(lead, 0, prev_alloc) | clean);
+		PUT(FTRP(bp), PACK(lead, 0, prev_alloc) | clean);
+		bst_add(bp);
+		prev_alloc = 0;
+		csize -= lead;
 	}
 
-	/* If oldptr is NULL, then this is just malloc. */
-	if(oldptr == NULL){
-		return malloc(size);
+	//trailing slack, same as place
+	if(csize - asize >= QSIZE){
+		arena->splits++;
+		PUT(HDRP(abp), PACK(asize, 1, prev_alloc));
+		bp = NEXT_BLKP(abp);
+		PUT(HDRP(bp), PACK(csize - asize, 0, 1) | clean);
+		PUT(FTRP(bp), PACK(csize - asize, 0, 1) | clean);
+		bst_add(bp);
+	}
+	else{
+		PUT(HDRP(abp), PACK(csize, 1, prev_alloc));
+		SET_PREV_ALLOC1(NEXT_BLKP(abp), 1);
 	}
+	if(NEXT_BLKP(abp) > arena->touched)
+		arena->touched = NEXT_BLKP(abp);
 
-	newptr = malloc(size);
+	return abp;
+}
 
-	/* If realloc() fails the original block is left untouched  */
-	if(!newptr){
-		return 0;
+/*********************************************************
+ * grow_heap_aligned - grow_heap so that the new top     *
+ * block has room for a block of asize bytes aligned to  *
+ * align, return it or NULL                              *
+ *********************************************************/
+static void *grow_heap_aligned(size_t asize, size_t align){
+	char *end = arena->brk;	//the payload of the new block starts here
+	size_t lead = ALIGN_UP(end, align) - (size_t)end;
+
+	if(lead != 0 && lead < QSIZE)
+		lead += align;
+	return grow_heap(lead + asize);
+}
+
+/******************************************************************************************************
+ *                                            Size Index                                              *
+ * Built with -DMM_SIZE_INDEX, every arena keeps the distinct sizes of the tree nodes, with their     *
+ * offsets, out of line in buckets of IDX_B sizes, sorted within the bucket and padded with IDX_NONE. *
+ * idx_first holds the first size of every bucket in order, so a search is a binary search of one     *
+ * contiguous array and a look at one or two buckets, a few cache lines that stay hot, and the heap   *
+ * is only touched at the block that is taken. Within a bucket the sizes below the one searched for   *
+ * are counted with a single vector compare (idx_rank). A full bucket is split in two, an empty one   *
+ * goes back to a free list; the arrays grow by doubling into a new mapping. The AVL tree is still    *
+ * kept: the index only changes when a size appears or disappears, a block of a size already there    *
+ * joins its chain without a walk down the tree, and find_fit asks the index instead of the tree. If  *
+ * the index cannot grow it is switched off until the arena is initialized again, and the tree is     *
+ * used.                                                                                              *
+ ******************************************************************************************************/
+#ifdef MM_SIZE_INDEX
+/*********************************************************
+ * idx_reset - empty the index of the current arena, its *
+ * memory is kept                                        *
+ *********************************************************/
+static void idx_reset(void){
+	arena->idx_buckets = 0;
+	arena->idx_free = 0;
+	arena->idx_unused = 0;
+	arena->idx_off = 0;
+}
+
+/*********************************************************
+ * idx_release - unmap the index of the current arena    *
+ *********************************************************/
+static void idx_release(void){
+	if(arena->idx_cap != 0)
+		munmap(arena->idx_pool, arena->idx_cap * (sizeof(idx_bucket_t) + sizeof(word_t) + sizeof(unsigned int)));
+	arena->idx_cap = 0;
+	idx_reset();
+}
+
+/*********************************************************
+ * idx_new_bucket - take a bucket for the index, growing *
+ * it if needed. return its number, or -1 and the index  *
+ * is off                                                *
+ *********************************************************/
+static int idx_new_bucket(void){
+	unsigned int id;
+
+	if(arena->idx_free != 0){
+		id = arena->idx_free - 1;
+		arena->idx_free = arena->idx_pool[id].node[0];
+	}
+	else{
+		if(arena->idx_unused == arena->idx_cap){	//twice the room in a new mapping
+			unsigned int cap = (arena->idx_cap != 0)? 2 * arena->idx_cap : PAGESIZE / sizeof(idx_bucket_t);
+			char *p = mmap(NULL, cap * (sizeof(idx_bucket_t) + sizeof(word_t) + sizeof(unsigned int)),
+					PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if(p == MAP_FAILED){
+				arena->idx_off = 1;
+				return -1;
+			}
+			idx_bucket_t *pool = (idx_bucket_t *)p;
+			word_t *first = (word_t *)(pool + cap);
+			unsigned int *map = (unsigned int *)(first + cap);
+			if(arena->idx_cap != 0){
+				memcpy(pool, arena->idx_pool, arena->idx_unused * sizeof(idx_bucket_t));
+				memcpy(first, arena->idx_first, arena->idx_buckets * sizeof(word_t));
+				memcpy(map, arena->idx_map, arena->idx_buckets * sizeof(unsigned int));
+				munmap(arena->idx_pool, arena->idx_cap * (sizeof(idx_bucket_t) + sizeof(word_t) + sizeof(unsigned int)));
+			}
+			arena->idx_pool = pool;
+			arena->idx_first = first;
+			arena->idx_map = map;
+			arena->idx_cap = cap;
+		}
+		id = arena->idx_unused++;
 	}
+	memset(arena->idx_pool[id].size, 0xff, sizeof(arena->idx_pool[id].size));	//IDX_NONE
+	return id;
+}
 
-	/* Copy the old data. */
-	oldsize = *SIZE_PTR(oldptr);
-	if(size < oldsize)
-		oldsize = size;
-	memcpy(newptr, oldptr, oldsize);
+/*********************************************************
+ * idx_bucket_of - the last bucket whose first size is   *
+ * at most size, the first one if there is none          *
+ *********************************************************/
+static unsigned int idx_bucket_of(size_t size){
+	unsigned int lo = 0, hi = arena->idx_buckets;
 
-	/* Free the old block. */
-	free(oldptr);
+	while(hi - lo > 1){
+		unsigned int mid = (lo + hi) / 2;
+		if(arena->idx_first[mid] <= size)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
 
-	return newptr;
+/*********************************************************
+ * idx_rank - the number of sizes in bucket b below size,*
+ * the slot where size is or would go                    *
+ *********************************************************/
+static unsigned int idx_rank(const idx_bucket_t *b, size_t size){
+	idx_vec_t lt = (idx_vec_t)(*(const idx_vec_t *)b->size < (word_t)size);	//~0 where less
+	unsigned int i, rank = 0;
+
+	for(i = 0; i < IDX_B; i++)
+		rank += lt[i] & 1;
+	return rank;
 }
 
 /*********************************************************
- * calloc - you may want to look at mm-naive.c           *
- * This function is not tested by mdriver, but it is     *
- * needed to run the traces.                             *
+ * idx_find - the tree node of the smallest size of at   *
+ * least asize, 0 if there is none                       *
  *********************************************************/
-void *calloc(size_t nmemb, size_t size){
-	//printf("calloc called, nmemb = %u, size = %u\n", (unsigned)nmemb, (unsigned)size);
+static word_t idx_find(size_t asize){
+	unsigned int j, k;
+	idx_bucket_t *b;
 
-	size_t bytes = nmemb * size;
-	void *newptr;
+	if(arena->idx_buckets == 0)
+		return 0;
+	j = idx_bucket_of(asize);
+	b = &arena->idx_pool[arena->idx_map[j]];
+	if((k = idx_rank(b, asize)) < IDX_B && b->size[k] != IDX_NONE)
+		return b->node[k];
+	if(j + 1 < arena->idx_buckets)	//the next bucket starts above asize
+		return arena->idx_pool[arena->idx_map[j + 1]].node[0];
+	return 0;
+}
+
+/*********************************************************
+ * idx_exact - the tree node of size, 0 if there is none *
+ *********************************************************/
+static word_t idx_exact(size_t size){
+	unsigned int k;
+	idx_bucket_t *b;
+
+	if(arena->idx_buckets == 0)
+		return 0;
+	b = &arena->idx_pool[arena->idx_map[idx_bucket_of(size)]];
+	k = idx_rank(b, size);
+	return (k < IDX_B && b->size[k] == size)? b->node[k] : 0;
+}
 
-	newptr = malloc(bytes);
-	memset(newptr, 0, bytes);
+/*********************************************************
+ * idx_insert - add a size that is new to the tree, with *
+ * the offset of its tree node                           *
+ *********************************************************/
+static void idx_insert(size_t size, word_t node){
+	unsigned int j, k;
+	idx_bucket_t *b;
+	int id;
 
-	return newptr;
+	if(arena->idx_off)
+		return;
+	if(arena->idx_buckets == 0){
+		if((id = idx_new_bucket()) == -1)
+			return;
+		arena->idx_first[0] = size;
+		arena->idx_map[0] = id;
+		arena->idx_buckets = 1;
+		arena->idx_pool[id].size[0] = size;
+		arena->idx_pool[id].node[0] = node;
+		return;
+	}
+
+	j = idx_bucket_of(size);
+	if(arena->idx_pool[arena->idx_map[j]].size[IDX_B - 1] != IDX_NONE){	//full: the upper half goes to a new bucket
+		if((id = idx_new_bucket()) == -1)
+			return;
+		b = &arena->idx_pool[arena->idx_map[j]];	//the pool may have moved
+		idx_bucket_t *n = &arena->idx_pool[id];
+		memcpy(n->size, b->size + IDX_B / 2, IDX_B / 2 * sizeof(word_t));
+		memcpy(n->node, b->node + IDX_B / 2, IDX_B / 2 * sizeof(word_t));
+		memset(b->size + IDX_B / 2, 0xff, IDX_B / 2 * sizeof(word_t));
+		memmove(arena->idx_first + j + 2, arena->idx_first + j + 1, (arena->idx_buckets - j - 1) * sizeof(word_t));
+		memmove(arena->idx_map + j + 2, arena->idx_map + j + 1, (arena->idx_buckets - j - 1) * sizeof(unsigned int));
+		arena->idx_first[j + 1] = n->size[0];
+		arena->idx_map[j + 1] = id;
+		arena->idx_buckets++;
+		if(size > n->size[0])
+			j++;
+	}
+
+	b = &arena->idx_pool[arena->idx_map[j]];
+	k = idx_rank(b, size);
+	memmove(b->size + k + 1, b->size + k, (IDX_B - 1 - k) * sizeof(word_t));
+	memmove(b->node + k + 1, b->node + k, (IDX_B - 1 - k) * sizeof(word_t));
+	b->size[k] = size;
+	b->node[k] = node;
+	if(k == 0)
+		arena->idx_first[j] = size;
 }
 
 /*********************************************************
- * Return whether the pointer is in the heap.            *
- * May be useful for debugging.                          *
+ * idx_set - another block became the tree node of size  *
  *********************************************************/
-static int in_heap(const void *p) {
-    return p <= mem_heap_hi() && p >= mem_heap_lo();
+static void idx_set(size_t size, word_t node){
+	idx_bucket_t *b;
+
+	if(arena->idx_off)
+		return;
+	b = &arena->idx_pool[arena->idx_map[idx_bucket_of(size)]];
+	b->node[idx_rank(b, size)] = node;
 }
 
 /*********************************************************
- * Return whether the pointer is aligned.                *
- * May be useful for debugging.                          *
+ * idx_remove - the last block of size left the tree     *
  *********************************************************/
-static int aligned(const void *p) {
-    return (size_t)ALIGN(p) == (size_t)p;
+static void idx_remove(size_t size){
+	unsigned int j, k;
+	idx_bucket_t *b;
+
+	if(arena->idx_off)
+		return;
+	j = idx_bucket_of(size);
+	b = &arena->idx_pool[arena->idx_map[j]];
+	k = idx_rank(b, size);
+	memmove(b->size + k, b->size + k + 1, (IDX_B - 1 - k) * sizeof(word_t));
+	memmove(b->node + k, b->node + k + 1, (IDX_B - 1 - k) * sizeof(word_t));
+	b->size[IDX_B - 1] = IDX_NONE;
+	if(b->size[0] == IDX_NONE){	//empty: back to the free list
+		b->node[0] = arena->idx_free;
+		arena->idx_free = arena->idx_map[j] + 1;
+		memmove(arena->idx_first + j, arena->idx_first + j + 1, (arena->idx_buckets - j - 1) * sizeof(word_t));
+		memmove(arena->idx_map + j, arena->idx_map + j + 1, (arena->idx_buckets - j - 1) * sizeof(unsigned int));
+		arena->idx_buckets--;
+	}
+	else if(k == 0)
+		arena->idx_first[j] = b->size[0];
 }
 
 /*********************************************************
- * Optimize the case when large number of malloc reqs of *
- * same size happens, otherwise BST will become a list   *
- * and have terrible throughput. Our make-do solution is *
- * to use address comparison to be a substitude of size  *
- * comparison. Implementation with hash techneque. Better*
- * solution should maintain a list when same size.       *
+ * idx_build - add the nodes of the subtree at root to   *
+ * the index, in order                                   *
  *********************************************************/
-inline unsigned int hash(void* p){
-	/*unsigned int table[64] = {3, 47, 22, 31, 14, 15, 7, 62, 
-				26, 16, 28, 27, 17, 13, 45, 60,
-				24, 8, 5, 12, 58, 47, 38, 53, 
-				0, 30, 9, 25, 43, 37, 32, 19, 
-				41, 52, 71, 62, 81, 33, 55, 50,
-				2, 11, 49, 10, 20, 6, 53, 21, 
-				18, 19, 54, 1, 23, 4, 29, 39,
-				81, 37, 62, 18, 77, 72, 79, 70};
-	return table[HASH(p)];*/
-	return (HASH(p) * HASH(p)) % 1973;
+static void idx_build(word_t root){
+	if(root == 0)
+		return;
+	idx_build(GET_LCO(O2P(root)));
+	idx_insert(GET_SIZE(HDRP(O2P(root))), root);
+	idx_build(GET_RCO(O2P(root)));
 }
+#endif
 
 /******************************************************************************************************
- *                                    Heap Checker with Helpers                                       *
+ *                                      Two-Level Segregated Fit                                      *
+ * Built with -DMM_TLSF, the free blocks of an arena are not kept in the AVL tree but in doubly       *
+ * linked lists, one per bin, with the next and prev offsets every free block has (prev 0: the first  *
+ * of its bin). A size below TLSF_SMALL has a bin of its own; above, the first level is the power of  *
+ * two the size is in and the second level one of TLSF_SL equal slices of it. A bit per bin in        *
+ * tlsf_sl_map and one per first level in tlsf_fl_map tell which bins have blocks, so a search is a   *
+ * find-first-set in at most two words: tlsf_find rounds the size up to the next bin, where every     *
+ * block fits, and takes the first block of the first bin from there on. This is a good fit rather    *
+ * than the best one, the price of malloc and free in constant time; coalescing, the block layout and *
+ * the footer elision are the same as with the tree. The lists are not kept in a persistent heap,     *
+ * opening one rebuilds them.                                                                         *
  ******************************************************************************************************/
-//unsigned long blkp[100000];	//only for debug use (checkheap), will be deleted when finish debugging
+#ifdef MM_TLSF
+/*********************************************************
+ * tlsf_reset - empty the bins of the current arena      *
+ *********************************************************/
+static void tlsf_reset(void){
+	arena->tlsf_fl_map = 0;
+	memset(arena->tlsf_sl_map, 0, sizeof(arena->tlsf_sl_map));
+	memset(arena->tlsf_bins, 0, sizeof(arena->tlsf_bins));
+}
 
 /*********************************************************
- * mm_checkheap                                          *
+ * tlsf_bin - the bin of a free block of size bytes,     *
+ * first level times TLSF_SL plus second level           *
  *********************************************************/
-void mm_checkheap_traverse(void *bp){
-	if(bp == NULL)
-		return;
-	if(GET_LCO(bp))
-		mm_checkheap_traverse(O2P(GET_LCO(bp)));
-	printf("BST INFO: bp = %lx\n", (unsigned long)bp);
-	if(GET_RCO(bp))
-		mm_checkheap_traverse(O2P(GET_RCO(bp)));
-	return;
+static unsigned int tlsf_bin(size_t size){
+	unsigned int msb;
+
+	if(size < TLSF_SMALL)
+		return size / DSIZE;
+	msb = 63 - __builtin_clzl(size);
+	return (msb - __builtin_ctz(TLSF_SMALL) + 1) * TLSF_SL + ((size >> (msb - TLSF_SL_SHIFT)) ^ TLSF_SL);
 }
 
-void mm_checkheap(int lineno){
-	//block check, iterate through implicitly
-	void *bp = heap_listp;
-	printf("checkheap called from line %d\n", lineno);
-	while(1){
-		int size = GET_SIZE(HDRP(bp));
-		int alloc = GET_ALLOC(HDRP(bp));
-		int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
-		printf("BLOCK INFO: bp = %lx, size = %u, alloc = %u, prev_alloc = %u\n", 
-			(unsigned long)bp, (unsigned)size, alloc, prev_alloc);
-		if(!alloc){
-			printf("	lco = %u, rco = %u\n", (unsigned)GET_LCO(bp), (unsigned)GET_RCO(bp));
-			printf("	lcp = %lx, rcp = %lx\n", (unsigned long)heap_listp + GET_LCO(bp), 
-				(unsigned long)heap_listp + GET_RCO(bp));
+/*********************************************************
+ * tlsf_insert - put free block bp first in its bin      *
+ *********************************************************/
+static void tlsf_insert(void *bp, size_t size){
+	unsigned int bin = tlsf_bin(size);
+	void *head = arena->tlsf_bins[bin];
+
+	PUT_NCO(bp, (head == NULL)? 0 : P2O(head));
+	PUT_PCO(bp, 0);
+	if(head != NULL)
+		PUT_PCO(head, P2O(bp));
+	arena->tlsf_bins[bin] = bp;
+	arena->tlsf_fl_map |= 1ul << (bin / TLSF_SL);
+	arena->tlsf_sl_map[bin / TLSF_SL] |= 1u << (bin % TLSF_SL);
+}
+
+/*********************************************************
+ * tlsf_remove - take free block bp out of its bin       *
+ *********************************************************/
+static void tlsf_remove(void *bp, size_t size){
+	word_t next = GET_NCO(bp);
+	word_t prev = GET_PCO(bp);
+
+	if(prev != 0)
+		PUT_NCO(O2P(prev), next);
+	else{	//the first of its bin
+		unsigned int bin = tlsf_bin(size);
+		arena->tlsf_bins[bin] = (next == 0)? NULL : O2P(next);
+		if(next == 0 && (arena->tlsf_sl_map[bin / TLSF_SL] &= ~(1u << (bin % TLSF_SL))) == 0)
+			arena->tlsf_fl_map &= ~(1ul << (bin / TLSF_SL));
+	}
+	if(next != 0)
+		PUT_PCO(O2P(next), prev);
+}
+
+/*********************************************************
+ * tlsf_find - a free block of at least asize bytes, the *
+ * first of the lowest bin whose blocks all fit, or else *
+ * the first of the bin of asize if it happens to fit    *
+ *********************************************************/
+static void *tlsf_find(size_t asize){
+	size_t size = asize;
+	unsigned int bin, fl, map;
+	unsigned long fl_map;
+	void *bp;
+
+	if(size >= TLSF_SMALL)	//round up to the next bin
+		size += ((size_t)1 << (63 - __builtin_clzl(size) - TLSF_SL_SHIFT)) - 1;
+	bin = tlsf_bin(size);
+	fl = bin / TLSF_SL;
+	map = (fl < TLSF_FL)? arena->tlsf_sl_map[fl] & (~0u << (bin % TLSF_SL)) : 0;
+	if(map == 0){	//a higher first level
+		fl_map = (fl + 1 < TLSF_FL)? arena->tlsf_fl_map & (~0ul << (fl + 1)) : 0;
+		if(fl_map == 0){
+			bp = arena->tlsf_bins[tlsf_bin(asize)];
+			return (bp != NULL && GET_SIZE(HDRP(bp)) >= asize)? bp : NULL;
 		}
-		if(size == 0)	//epilogue
-			break;
-		bp = NEXT_BLKP(bp);
+		fl = __builtin_ctzl(fl_map);
+		map = arena->tlsf_sl_map[fl];
 	}
+	return arena->tlsf_bins[fl * TLSF_SL + __builtin_ctz(map)];
+}
 
-	//BST check
-	printf("BST INFO: free_listp = %lx\n", (unsigned long)free_listp);
-	mm_checkheap_traverse(free_listp);
+/*********************************************************
+ * tlsf_largest - the largest free block, NULL if none   *
+ *********************************************************/
+static void *tlsf_largest(void){
+	unsigned int fl;
+	void *bp, *max;
+
+	if(arena->tlsf_fl_map == 0)
+		return NULL;
+	fl = 63 - __builtin_clzl(arena->tlsf_fl_map);
+	max = bp = arena->tlsf_bins[fl * TLSF_SL + 31 - __builtin_clz(arena->tlsf_sl_map[fl])];
+	while(GET_NCO(bp) != 0){	//the highest bin is not in order
+		bp = O2P(GET_NCO(bp));
+		if(GET_SIZE(HDRP(bp)) > GET_SIZE(HDRP(max)))
+			max = bp;
+	}
+	return max;
+}
+
+/*********************************************************
+ * tlsf_scavenge - scavenge the free blocks of at least  *
+ * min bytes, return the bytes released                  *
+ *********************************************************/
+static size_t tlsf_scavenge(size_t min){
+	unsigned int bin;
+	size_t released = 0;
+	void *bp;
+
+	for(bin = tlsf_bin(min); bin < TLSF_FL * TLSF_SL; bin++)
+		for(bp = arena->tlsf_bins[bin]; bp != NULL; bp = GET_NCO(bp)? O2P(GET_NCO(bp)) : NULL)
+			if(GET_SIZE(HDRP(bp)) >= min)
+				released += scavenge_block(bp);
+	return released;
+}
+#endif
+
+/******************************************************************************************************
+ *                                       Small Object Slabs                                           *
+ * Requests of at most SLAB_MAX bytes are served from slabs: allocated blocks of PAGESIZE bytes whose *
+ * payload is page aligned. The slab header (slab_t) sits at the start of the page, followed by       *
+ * headerless objects of a single size class. slab_map has one bit per heap page, so free can tell a  *
+ * small object from an ordinary block without reading the word before it.                            *
+ ******************************************************************************************************/
+/*********************************************************
+ * slab_malloc - return NULL if no slab can be made, the *
+ * caller then falls back to the BST                     *
+ *********************************************************/
+static void *slab_malloc(size_t size){
+	int cls = slab_class[(size + (ALIGNMENT - 1)) / ALIGNMENT];
+	slab_t *slab = arena->slab_partial[cls];
+	void *bp;
+
+	if(slab == NULL && (slab = slab_new(cls)) == NULL)
+		return NULL;
+
+	if(slab->free != NULL){	//reuse a freed object
+		bp = slab->free;
+		slab->free = *(void **)bp;
+	}
+	else	//carve a fresh object
+		bp = (char *)slab + SLAB_HSIZE + (size_t)slab->bump++ * slab_size[cls];
+
+	//full now: drop it from the partial list
+	if(++slab->used == SLAB_COUNT(cls)){
+		arena->slab_partial[cls] = slab->next;
+		if(slab->next != NULL)
+			slab->next->prev = NULL;
+		slab->next = NULL;
+	}
+	return bp;
+}
+
+/*********************************************************
+ * slab_free - give a small object back to its slab      *
+ *********************************************************/
+static void slab_free(void *bp){
+	slab_t *slab = SLAB_OF(bp);
+	int cls = slab->cls;
+
+	*(void **)bp = slab->free;
+	slab->free = bp;
+
+	//was full: back to the partial list
+	if(slab->used-- == SLAB_COUNT(cls)){
+		slab->prev = NULL;
+		slab->next = arena->slab_partial[cls];
+		if(slab->next != NULL)
+			slab->next->prev = slab;
+		arena->slab_partial[cls] = slab;
+	}
+
+	//empty: return the page to the heap, but keep the last slab of the class to avoid thrashing
+	if(slab->used == 0 && (slab->next != NULL || slab->prev != NULL)){
+		if(slab->prev != NULL)
+			slab->prev->next = slab->next;
+		else
+			arena->slab_partial[cls] = slab->next;
+		if(slab->next != NULL)
+			slab->next->prev = slab->prev;
+		SLAB_MAP_CLEAR(slab);
+		arena_free(slab);
+	}
+}
+
+/*********************************************************
+ * slab_new - make an empty slab of class cls and put it *
+ * on the partial list                                   *
+ *********************************************************/
+static slab_t *slab_new(int cls){
+	slab_t *slab = slab_page();
+
+	if(slab == NULL)
+		return NULL;
+	if(PAGE_INDEX(arena, slab) >= SLAB_MAP_BITS){	//out of the range of slab_map
+		arena_free(slab);
+		return NULL;
+	}
+
+	slab->prev = NULL;
+	slab->next = arena->slab_partial[cls];
+	if(slab->next != NULL)
+		slab->next->prev = slab;
+	slab->free = NULL;
+	slab->used = 0;
+	slab->bump = 0;
+	slab->cls = cls;
+	arena->slab_partial[cls] = slab;
+	SLAB_MAP_SET(slab);
+	if(PAGE_INDEX(arena, slab) >= arena->slab_map_hi)
+		__atomic_store_n(&arena->slab_map_hi, PAGE_INDEX(arena, slab) + 1, __ATOMIC_RELAXED);
+	return slab;
+}
+
+/*********************************************************
+ * slab_page - allocate a block of PAGESIZE bytes whose  *
+ * payload is page aligned                               *
+ *********************************************************/
+static void *slab_page(void){
+	void *bp = find_fit_aligned(PAGESIZE, PAGESIZE);
+
+	if(bp == NULL && (bp = grow_heap_aligned(PAGESIZE, PAGESIZE)) == NULL)
+		return NULL;
+	return place_aligned(bp, PAGESIZE, PAGESIZE);
+}
+
+/******************************************************************************************************
+ *                                    Arenas and Thread Caches                                        *
+ * Every thread allocates from one of up to MM_ARENAS arenas, handed out round robin. The main arena  *
+ * lives on memlib, the others reserve ARENA_SIZE bytes of address space with mmap and grow into it.  *
+ * All the functions above work on the arena in the thread local arena, whose lock is held.           *
+ * A thread keeps up to TCACHE_MAX recently freed small objects per class and reuses them without any *
+ * lock. A block freed by a thread that is not its owner's and cannot take the owner's lock goes to   *
+ * the owner's remote list with a single compare-and-swap; the next thread to lock the arena frees it.*
+ ******************************************************************************************************/
+/*********************************************************
+ * arena_lock - lock arena a and make it current         *
+ *********************************************************/
+static void arena_lock(arena_t *a){
+	pthread_mutex_lock(&a->lock);
+	arena_enter(a);
+}
+
+/*********************************************************
+ * arena_enter - make the locked arena a current and     *
+ * free whatever other threads left on its remote list   *
+ *********************************************************/
+static void arena_enter(arena_t *a){
+	void *bp, *next;
+
+	arena = a;
+	if(__atomic_load_n(&a->remote, __ATOMIC_RELAXED) == NULL)
+		return;
+	bp = __atomic_exchange_n(&a->remote, NULL, __ATOMIC_ACQUIRE);
+	while(bp != NULL){
+		next = *(void **)bp;
+		arena_free(bp);
+		bp = next;
+	}
+}
+
+/*********************************************************
+ * arena_unlock - unlock the current arena               *
+ *********************************************************/
+static void arena_unlock(void){
+	pthread_mutex_unlock(&arena->lock);
+}
+
+/*********************************************************
+ * arena_of - the arena that owns the block bp           *
+ *********************************************************/
+static arena_t *arena_of(const void *bp){
+	unsigned int i, n = __atomic_load_n(&narenas, __ATOMIC_ACQUIRE);
+
+	for(i = 1; i < n; i++)
+		if((char *)bp >= arenas[i]->lo && (char *)bp < arenas[i]->end)
+			return arenas[i];
+	return &main_arena;	//memlib, no fixed bounds
+}
+
+/*********************************************************
+ * arena_attach - pick the arena of the calling thread,  *
+ * creating it on first use                              *
+ *********************************************************/
+static arena_t *arena_attach(void){
+	arena_t *a;
+	unsigned int i;
+
+	pthread_once(&tcache_once, tcache_key_init);
+	pthread_setspecific(tcache_key, (void *)1);	//so that tcache_destroy runs at thread exit
+
+	pthread_mutex_lock(&arenas_lock);
+	tstats.prev = NULL;
+	if((tstats.next = tstats_list) != NULL)	//so that mm_stats finds the calls of this thread
+		tstats_list->prev = &tstats;
+	tstats_list = &tstats;
+	i = nthreads++ % MM_ARENAS;
+	if(i == narenas && (a = arena_create()) != NULL){
+		arenas[i] = a;
+		__atomic_store_n(&narenas, i + 1, __ATOMIC_RELEASE);
+	}
+	thread_arena = arenas[(i < narenas)? i : 0];
+	pthread_mutex_unlock(&arenas_lock);
+	return thread_arena;
+}
+
+/*********************************************************
+ * arena_create - reserve a new arena, its heap is       *
+ * created on first use                                  *
+ *********************************************************/
+static arena_t *arena_create(void){
+	size_t hsize = ALIGN_UP(sizeof(arena_t), PAGESIZE);
+	char *p = heap_reserve(hsize);
+	arena_t *a = (arena_t *)p;
+
+	if(p == NULL)
+		return NULL;
+	pthread_mutex_init(&a->lock, NULL);	//everything else is zero
+	a->lo = a->brk = a->fresh = p + hsize;
+	a->end = p + hsize + ARENA_SIZE;
+	return a;
+}
+
+/*********************************************************
+ * heap_reserve - reserve hsize bytes (a multiple of     *
+ * PAGESIZE) followed by a heap of ARENA_SIZE bytes,     *
+ * return the start or NULL. With MM_HUGE_PAGES the heap *
+ * starts on a huge page boundary                        *
+ *********************************************************/
+static char *heap_reserve(size_t hsize){
+#ifdef MM_HUGE_PAGES
+	char *r = mmap(NULL, hsize + ARENA_SIZE + HUGE_PAGE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	char *p = (char *)ALIGN_UP(r + hsize, HUGE_PAGE) - hsize;
+
+	if(r == MAP_FAILED)
+		return NULL;
+	if(p != r)	//keep hsize + ARENA_SIZE bytes from p on
+		munmap(r, p - r);
+	munmap(p + hsize + ARENA_SIZE, r + HUGE_PAGE - p);
+	huge_advise(p + hsize, p + hsize + ARENA_SIZE);
+	return p;
+#else
+	char *p = mmap(NULL, hsize + ARENA_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+	return (p == MAP_FAILED)? NULL : p;
+#endif
+}
+
+#ifdef MM_HUGE_PAGES
+/*********************************************************
+ * huge_advise - ask for transparent huge pages for the  *
+ * whole huge pages in [lo, hi)                          *
+ *********************************************************/
+static void huge_advise(char *lo, char *hi){
+	lo = (char *)ALIGN_UP(lo, HUGE_PAGE);
+	hi = (char *)ALIGN_DOWN(hi, HUGE_PAGE);
+	if(lo < hi)
+		madvise(lo, hi - lo, MADV_HUGEPAGE);	//a kernel without THP says EINVAL, the heap works on without
+}
+#endif
+
+/*********************************************************
+ * remote_push - leave bp for the owner arena a to free  *
+ *********************************************************/
+static void remote_push(arena_t *a, void *bp){
+	void *head = __atomic_load_n(&a->remote, __ATOMIC_RELAXED);
+
+	do
+		*(void **)bp = head;
+	while(!__atomic_compare_exchange_n(&a->remote, &head, bp, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*********************************************************
+ * tcache_fill - malloc one small object from the current*
+ * arena and put up to TCACHE_FILL - 1 more in the cache *
+ *********************************************************/
+static void *tcache_fill(int cls, size_t size){
+	void *bp;
+	int i;
+
+	if((bp = arena_malloc(size, NULL)) == NULL || tcache_exiting)
+		return bp;
+	for(i = 1; i < TCACHE_FILL; i++){
+		void *extra = slab_malloc(slab_size[cls]);
+		if(extra == NULL)
+			break;
+		*(void **)extra = tcache[cls].head;
+		tcache[cls].head = extra;
+		tcache[cls].count++;
+	}
+	return bp;
+}
+
+/*********************************************************
+ * tcache_flush - give small objects of class cls back   *
+ * until keep are left in the cache                      *
+ *********************************************************/
+static void tcache_flush(int cls, unsigned int keep){
+	arena_lock(thread_arena);
+	while(tcache[cls].count > keep){
+		void *bp = tcache[cls].head;
+		tcache[cls].head = *(void **)bp;
+		tcache[cls].count--;
+
+		arena_t *owner = arena_of(bp);
+		if(owner == arena)
+			arena_free(bp);
+		else
+			remote_push(owner, bp);
+	}
+	arena_unlock();
+}
+
+/*********************************************************
+ * tcache_destroy - flush the whole cache of an exiting  *
+ * thread, keep its calls in tstats_exited               *
+ *********************************************************/
+static void tcache_destroy(void *unused){
+	int cls;
+
+	(void)unused;
+	tcache_exiting = 1;	//destructors that run after this one may still free
+	for(cls = 0; cls < SLAB_CLASSES; cls++)
+		if(tcache[cls].count != 0)
+			tcache_flush(cls, 0);
+
+	pthread_mutex_lock(&arenas_lock);
+	tstats_add(&tstats_exited, &tstats);
+	if(tstats.next != NULL)
+		tstats.next->prev = tstats.prev;
+	if(tstats.prev != NULL)
+		tstats.prev->next = tstats.next;
+	else
+		tstats_list = tstats.next;
+	pthread_mutex_unlock(&arenas_lock);
+	memset(&tstats, 0, offsetof(tstats_t, next));	//later calls are added by tstats_fold
+}
+
+/*********************************************************
+ * tcache_put_exiting - free small object bp of class    *
+ * cls for a thread past tcache_destroy, straight to the *
+ * arena that owns it                                    *
+ *********************************************************/
+static void tcache_put_exiting(void *bp, int cls){
+	STAT_CALL(free_calls, cls);
+	arena_lock(arena_of(bp));
+	arena_free(bp);
+	arena_unlock();
+	tstats_fold();
+}
+
+/*********************************************************
+ * tstats_fold - move the calls made by a thread past    *
+ * tcache_destroy into tstats_exited, where mm_stats     *
+ * still finds them                                      *
+ *********************************************************/
+static void tstats_fold(void){
+	pthread_mutex_lock(&arenas_lock);
+	tstats_add(&tstats_exited, &tstats);
+	pthread_mutex_unlock(&arenas_lock);
+	memset(&tstats, 0, offsetof(tstats_t, next));
+}
+
+static void tcache_key_init(void){
+	pthread_key_create(&tcache_key, tcache_destroy);
+}
+
+/******************************************************************************************************
+ *                                         Large Objects                                              *
+ * Requests of at least mmap_threshold bytes get an anonymous mapping of their own, so they never     *
+ * fragment an arena and go back to the system as soon as they are freed. The mapping starts with     *
+ * its length and a header word of size 0, which no heap block has. When a mapped block larger than   *
+ * the threshold is freed the threshold moves up to its size (at most MMAP_THRESHOLD_MAX), so a size  *
+ * that keeps being allocated and freed ends up on the cheaper heap path.                             *
+ ******************************************************************************************************/
+/*********************************************************
+ * mmap_malloc - return NULL if the mapping fails        *
+ *********************************************************/
+static void *mmap_malloc(size_t size){
+	size_t len = ALIGN_UP(size + MMAP_HSIZE, PAGESIZE);
+	char *map;
+
+	if(len < size){	//overflow
+		errno = ENOMEM;
+		return NULL;
+	}
+	map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(map == MAP_FAILED)
+		return NULL;
+	*(size_t *)map = len;
+	PUT(map + MMAP_HSIZE - WSIZE, PACK(0, 1, 1));
+	__atomic_fetch_add(&mmapped_bytes, len, __ATOMIC_RELAXED);
+	return map + MMAP_HSIZE;
+}
+
+/*********************************************************
+ * mmap_free - unmap a mapped block and raise the        *
+ * threshold over its size                               *
+ *********************************************************/
+static void mmap_free(void *bp){
+	size_t len = MMAP_LEN(bp);
+	size_t size = len - MMAP_HSIZE;
+
+	munmap((char *)bp - MMAP_HSIZE, len);
+	__atomic_fetch_sub(&mmapped_bytes, len, __ATOMIC_RELAXED);
+	if(!__atomic_load_n(&mmap_threshold_fixed, __ATOMIC_RELAXED) && size <= MMAP_THRESHOLD_MAX
+			&& size >= __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED))
+		__atomic_store_n(&mmap_threshold, size + 1, __ATOMIC_RELAXED);
+}
+
+/*********************************************************
+ * mmap_realloc - resize a mapped block with mremap, the *
+ * kernel moves the pages instead of copying them.       *
+ * return NULL if the caller has to copy                 *
+ *********************************************************/
+static void *mmap_realloc(void *bp, size_t size){
+	size_t len = MMAP_LEN(bp);
+	size_t newlen = ALIGN_UP(size + MMAP_HSIZE, PAGESIZE);
+	char *map;
+
+	if(newlen < size)	//overflow
+		return NULL;
+	if(newlen == len)
+		return bp;
+	map = mremap((char *)bp - MMAP_HSIZE, len, newlen, MREMAP_MAYMOVE);
+	if(map == MAP_FAILED)
+		return NULL;
+	*(size_t *)map = newlen;
+	__atomic_fetch_add(&mmapped_bytes, newlen - len, __ATOMIC_RELAXED);	//wraps around when it shrinks
+	return map + MMAP_HSIZE;
+}
+
+/*********************************************************
+ * mm_set_mmap_threshold - see mm_ext.h                  *
+ *********************************************************/
+void mm_set_mmap_threshold(size_t bytes){
+	__atomic_store_n(&mmap_threshold_fixed, bytes != 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&mmap_threshold, (bytes != 0)? bytes : MMAP_THRESHOLD, __ATOMIC_RELAXED);
+}
+
+/******************************************************************************************************
+ *                                           Quick Lists                                              *
+ * Coalescing is deferred for heap blocks of at most QUICK_MAX bytes. A freed one is pushed on the    *
+ * quick list of its exact size and keeps its allocated header, so to its neighbours, the prev-alloc  *
+ * bits and the heap checker it still is an allocated block, and the next malloc of that size takes   *
+ * it back without a look at the BST. The blocks are merged and go to the BST all at once, list by    *
+ * list when a list already holds quick_len blocks, and all lists when find_fit finds no fit and      *
+ * before the heap grows. Deferring trades utilization for speed: until the flush, the bytes on the   *
+ * lists serve no other size.                                                                         *
+ ******************************************************************************************************/
+/*********************************************************
+ * quick_put - push heap block bp of size bytes on its   *
+ * quick list, flushing the list first if it is full.    *
+ * return 0 if the lists are off and bp is still to free *
+ *********************************************************/
+static int quick_put(void *bp, size_t size){
+	unsigned int i = size / DSIZE;
+	unsigned int len = __atomic_load_n(&quick_len, __ATOMIC_RELAXED);
+
+	if(arena->quick_count[i] >= len){
+		if(arena->quick_count[i] != 0)
+			quick_flush(i);
+		if(len == 0)
+			return 0;
+	}
+	CHECK_TICK();
+	*(void **)bp = arena->quick[i];
+	arena->quick[i] = bp;
+	arena->quick_count[i]++;
+	arena->quick_blocks++;
+	arena->quick_bytes += size;
+	return 1;
+}
+
+/*********************************************************
+ * quick_flush - free the blocks on quick list i for     *
+ * real: coalesce each into the BST                      *
+ *********************************************************/
+static void quick_flush(unsigned int i){
+	void *bp = arena->quick[i], *next;
+	size_t size = (size_t)i * DSIZE;
+
+	arena->quick_flushes++;
+	arena->quick_blocks -= arena->quick_count[i];
+	arena->quick_bytes -= arena->quick_count[i] * size;
+	arena->quick[i] = NULL;
+	arena->quick_count[i] = 0;
+	for(; bp != NULL; bp = next){
+		int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+
+		next = *(void **)bp;
+		PUT(HDRP(bp), PACK(size, 0, prev_alloc));
+		PUT(FTRP(bp), PACK(size, 0, prev_alloc));
+		coalesce(bp);
+	}
+}
+
+/*********************************************************
+ * quick_flush_all - quick_flush every list              *
+ *********************************************************/
+static void quick_flush_all(void){
+	unsigned int i;
+
+	for(i = 0; arena->quick_blocks != 0 && i < QUICK_LISTS; i++)
+		if(arena->quick_count[i] != 0)
+			quick_flush(i);
+}
+
+/*********************************************************
+ * mm_set_quick - see mm_ext.h                           *
+ *********************************************************/
+void mm_set_quick(unsigned int len){
+	__atomic_store_n(&quick_len, MIN(len, QUICK_LEN_MAX), __ATOMIC_RELAXED);
+}
+
+/******************************************************************************************************
+ *                                     Trimming and Scavenging                                        *
+ * Free memory goes back to the system in two ways. When the top block (the free block next to the    *
+ * epilogue) grows over trim_threshold, the heap is cut back to top_pad bytes into it (trim). memlib  *
+ * cannot take memory back, so the main arena only moves its own brk down and arena_sbrk reuses the   *
+ * space above it before asking memlib for more. The whole pages inside a large free block are        *
+ * released in place (scavenge); its header, BST links and footer stay where they are. Released pages *
+ * read back as zero, so a scavenged block becomes CLEAN and a trim lowers arena->fresh. Every        *
+ * DECAY_EVERY frees an arena looks at the clock and scavenges its free blocks of at least            *
+ * SCAVENGE_MIN bytes if decay_ms milliseconds have passed since the last time. Built with            *
+ * -DMM_HUGE_PAGES, memory goes back in whole huge pages (RELEASE_PAGE) so that the kernel never has  *
+ * to split one: a trim leaves the brk on a huge page boundary, and only the huge pages inside a free *
+ * block are scavenged. grow_heap keeps the brk of every heap on the same boundaries; for the main    *
+ * arena, whose memlib reservation is not aligned, arena_sbrk asks for huge pages for the part of the *
+ * heap it has just reached.                                                                          *
+ ******************************************************************************************************/
+/*********************************************************
+ * arena_trim - cut the heap of the current arena back   *
+ * to pad bytes into its top block.                      *
+ * return the number of bytes released                   *
+ *********************************************************/
+static size_t arena_trim(size_t pad){
+	char *top = arena->brk;	//the epilogue header is right below
+	char *bp, *end, *lo, *hi;
+	size_t keep;
+
+	if(arena->heap_listp == NULL || arena->pheap != NULL || GET_PREV_ALLOC(HDRP(top)))
+		return 0;	//no free top block, or one in a file, whose pages madvise does not zero
+	bp = PREV_BLKP(top);
+	keep = ALIGN_UP(pad, DSIZE);	//what is left of the top block
+	if(keep != 0 && keep < QSIZE)
+		keep = QSIZE;
+	end = bp + keep;	//the new brk
+#ifdef MM_HUGE_PAGES
+	end = (char *)ALIGN_UP(end, HUGE_PAGE);	//the top block keeps the rest of its huge page
+	if(end - bp != 0 && end - bp < QSIZE)
+		end += HUGE_PAGE;
+	keep = end - bp;
+#endif
+	lo = (char *)ALIGN_UP(end, RELEASE_PAGE);
+	hi = (char *)ALIGN_DOWN(top, RELEASE_PAGE);	//the page of top may lie beyond memlib's heap
+	if(keep >= GET_SIZE(HDRP(bp)) || lo >= hi)
+		return 0;	//not a single page to give back
+
+	bst_delete(bp);
+	if(keep != 0){	//a prefix of a clean block is still clean
+		word_t hdr = (GET(HDRP(bp)) & 0x7) | keep;
+		PUT(HDRP(bp), hdr);
+		PUT(FTRP(bp), hdr);
+		bst_add(bp);
+	}
+	PUT(HDRP(end), PACK(0, 1, (keep == 0)? GET_PREV_ALLOC(HDRP(bp)) : 0));	//new epilogue header
+	memset(end, 0, lo - end);
+	memset(hi, 0, top - hi);
+	madvise(lo, hi - lo, MADV_RELEASE);
+#ifndef MM_MADV_FREE
+	if(arena->fresh == top)	//everything from end on reads as zero
+		arena->fresh = end;
+#endif
+	arena->brk = end;
+	arena->touched = MIN(arena->touched, end);
+	if(arena->check_at >= end)	//gone with the top block
+		arena->check_at = NULL;
+	arena->grow_shift = GROW_SHIFT_TRIMMED;	//the heap was larger than needed, grow back slowly
+	return hi - lo;
+}
+
+/*********************************************************
+ * arena_scavenge - release the pages of the free blocks *
+ * of at least min bytes of the current arena.           *
+ * return the number of bytes released                   *
+ *********************************************************/
+static size_t arena_scavenge(size_t min){
+#ifdef MM_TLSF
+	if(arena->heap_listp == NULL || arena->pheap != NULL)
+		return 0;
+	return tlsf_scavenge(min);
+#endif
+	if(arena->heap_listp == NULL || arena->free_listp == NULL || arena->pheap != NULL)
+		return 0;
+	return scavenge_tree(P2O(arena->free_listp), min);
+}
+
+/*********************************************************
+ * scavenge_tree - arena_scavenge on the subtree at root,*
+ * only the part of it of sizes >= min is visited        *
+ *********************************************************/
+static size_t scavenge_tree(word_t root, size_t min){
+	size_t released = 0;
+	word_t offset;
+	void *bp;
+
+	if(root == 0)
+		return 0;
+	bp = O2P(root);
+	if(GET_SIZE(HDRP(bp)) >= min){
+		released += scavenge_tree(GET_LCO(bp), min);
+		for(offset = root; offset != 0; offset = GET_NCO(O2P(offset)))	//the node and its chain
+			released += scavenge_block(O2P(offset));
+	}
+	return released + scavenge_tree(GET_RCO(bp), min);
+}
+
+/*********************************************************
+ * scavenge_block - release the pages of free block bp   *
+ * that hold neither its links nor its footer            *
+ *********************************************************/
+static size_t scavenge_block(void *bp){
+	char *start = (char *)bp + LINK_BYTES;
+	char *end = FTRP(bp);
+	char *lo = (char *)ALIGN_UP(start, RELEASE_PAGE);
+	char *hi = (char *)ALIGN_DOWN(end, RELEASE_PAGE);
+
+	if(GET_CLEAN(HDRP(bp)) || lo >= hi)	//clean blocks have been released or never touched
+		return 0;
+	if(madvise(lo, hi - lo, MADV_RELEASE) != 0)
+		return 0;
+#ifndef MM_MADV_FREE
+	memset(start, 0, lo - start);	//zero the partial pages as well, then the block is clean
+	memset(hi, 0, end - hi);
+	PUT(HDRP(bp), GET(HDRP(bp)) | CLEAN);
+	PUT(FTRP(bp), GET(FTRP(bp)) | CLEAN);
+#endif
+	return hi - lo;
+}
+
+/*********************************************************
+ * decay_tick - scavenge the current arena if decay_ms   *
+ * have passed since it was last scavenged               *
+ *********************************************************/
+static void decay_tick(void){
+	unsigned int ms = __atomic_load_n(&decay_ms, __ATOMIC_RELAXED);
+	struct timespec ts;
+	unsigned long now;
+
+	arena->frees = 0;
+	if(ms == 0)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = (unsigned long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+	if(arena->scavenged_at == 0)	//the first look starts the clock
+		arena->scavenged_at = now;
+	else if(now - arena->scavenged_at >= ms){
+		arena_scavenge(SCAVENGE_MIN);
+		arena->scavenged_at = now;
+	}
+}
+
+/*********************************************************
+ * mm_trim - see mm_ext.h                                *
+ *********************************************************/
+int mm_trim(size_t pad){
+	size_t released = 0;
+	unsigned int i, n = __atomic_load_n(&narenas, __ATOMIC_ACQUIRE);
+
+	for(i = 0; i < n; i++){
+		arena_lock(arenas[i]);
+		quick_flush_all();	//they may hold up the top block
+		released += arena_trim(pad);
+		released += arena_scavenge(RELEASE_PAGE + LINK_BYTES);
+		arena_unlock();
+	}
+	return released != 0;
+}
+
+/*********************************************************
+ * mm_set_trim_threshold, mm_set_top_pad, mm_set_decay - *
+ * see mm_ext.h                                          *
+ *********************************************************/
+void mm_set_trim_threshold(size_t bytes){
+	__atomic_store_n(&trim_threshold, bytes, __ATOMIC_RELAXED);
+}
+
+void mm_set_top_pad(size_t bytes){
+	__atomic_store_n(&top_pad, bytes, __ATOMIC_RELAXED);
+}
+
+void mm_set_decay(unsigned int ms){
+	__atomic_store_n(&decay_ms, ms, __ATOMIC_RELAXED);
+}
+
+/*********************************************************
+ * mm_set_grow_cap, mm_get_growth - see mm_ext.h         *
+ *********************************************************/
+void mm_set_grow_cap(size_t bytes){
+	__atomic_store_n(&grow_cap, (bytes != 0)? bytes : GROW_CAP, __ATOMIC_RELAXED);
+}
+
+void mm_get_growth(mm_growth_t *g){
+	unsigned int i, n = __atomic_load_n(&narenas, __ATOMIC_ACQUIRE);
+
+	memset(g, 0, sizeof(*g));
+	for(i = 0; i < n; i++){
+		arena_lock(arenas[i]);
+		if(arena->heap_listp != NULL){
+			g->sbrk_calls += arena->sbrks;
+			g->heap_bytes += arena->brk - arena->lo;
+			g->untouched_bytes += arena->brk - arena->touched;
+		}
+		arena_unlock();
+	}
+}
+
+/******************************************************************************************************
+ *                                            Statistics                                              *
+ * The counters are always on and cost an increment each. Arenas count their free blocks, splits,     *
+ * coalesces, BST searches and growths under their own lock; every thread counts its calls in tstats, *
+ * which only it writes, so mm_stats reads them without stopping anybody. A thread that exits adds    *
+ * its calls to tstats_exited. Calls are counted by size class (see MM_STAT_CLASSES in mm_ext.h).     *
+ ******************************************************************************************************/
+static const struct{
+	const char *name;
+	size_t offset;	//in mm_stats_t
+	unsigned int count;	//number of size_t, more than one for an array
+} stat_fields[] = {
+	{"heap_bytes", offsetof(mm_stats_t, heap_bytes), 1},
+	{"in_use_bytes", offsetof(mm_stats_t, in_use_bytes), 1},
+	{"free_bytes", offsetof(mm_stats_t, free_bytes), 1},
+	{"free_blocks", offsetof(mm_stats_t, free_blocks), 1},
+	{"quick_bytes", offsetof(mm_stats_t, quick_bytes), 1},
+	{"quick_blocks", offsetof(mm_stats_t, quick_blocks), 1},
+	{"quick_flushes", offsetof(mm_stats_t, quick_flushes), 1},
+	{"mmapped_bytes", offsetof(mm_stats_t, mmapped_bytes), 1},
+	{"untouched_bytes", offsetof(mm_stats_t, untouched_bytes), 1},
+	{"sbrk_calls", offsetof(mm_stats_t, sbrk_calls), 1},
+	{"splits", offsetof(mm_stats_t, splits), 1},
+	{"coalesce", offsetof(mm_stats_t, coalesce), 4},
+	{"fit_misses", offsetof(mm_stats_t, fit_misses), 1},
+	{"fit_depth", offsetof(mm_stats_t, fit_depth), MM_STAT_DEPTHS},
+	{"malloc_calls", offsetof(mm_stats_t, malloc_calls), MM_STAT_CLASSES},
+	{"free_calls", offsetof(mm_stats_t, free_calls), MM_STAT_CLASSES},
+	{"realloc_calls", offsetof(mm_stats_t, realloc_calls), MM_STAT_CLASSES},
+};
+
+/*********************************************************
+ * tstats_add - add the calls counted in from to to      *
+ *********************************************************/
+static void tstats_add(tstats_t *to, const tstats_t *from){
+	int i;
+
+	for(i = 0; i < MM_STAT_CLASSES; i++){
+		to->malloc_calls[i] += __atomic_load_n(&from->malloc_calls[i], __ATOMIC_RELAXED);
+		to->free_calls[i] += __atomic_load_n(&from->free_calls[i], __ATOMIC_RELAXED);
+		to->realloc_calls[i] += __atomic_load_n(&from->realloc_calls[i], __ATOMIC_RELAXED);
+	}
+}
+
+/*********************************************************
+ * mm_stats - see mm_ext.h                               *
+ *********************************************************/
+void mm_stats(mm_stats_t *st){
+	unsigned int i, n = __atomic_load_n(&narenas, __ATOMIC_ACQUIRE);
+	tstats_t calls;
+	tstats_t *t;
+	int k;
+
+	memset(st, 0, sizeof(*st));
+	for(i = 0; i < n; i++){
+		arena_lock(arenas[i]);
+		if(arena->heap_listp != NULL){
+			st->heap_bytes += arena->brk - arena->lo;
+			st->free_bytes += arena->free_bytes;
+			st->free_blocks += arena->free_blocks;
+			st->quick_bytes += arena->quick_bytes;
+			st->quick_blocks += arena->quick_blocks;
+			st->quick_flushes += arena->quick_flushes;
+			st->untouched_bytes += arena->brk - arena->touched;
+			st->sbrk_calls += arena->sbrks;
+			st->splits += arena->splits;
+			st->fit_misses += arena->fit_misses;
+			for(k = 0; k < 4; k++)
+				st->coalesce[k] += arena->coalesces[k];
+			for(k = 0; k < MM_STAT_DEPTHS; k++)
+				st->fit_depth[k] += arena->fit_depth[k];
+		}
+		arena_unlock();
+	}
+	st->mmapped_bytes = __atomic_load_n(&mmapped_bytes, __ATOMIC_RELAXED);
+	st->in_use_bytes = st->heap_bytes - st->free_bytes - st->quick_bytes + st->mmapped_bytes;
+
+	pthread_mutex_lock(&arenas_lock);
+	calls = tstats_exited;
+	for(t = tstats_list; t != NULL; t = t->next)
+		tstats_add(&calls, t);
+	pthread_mutex_unlock(&arenas_lock);
+	memcpy(st->malloc_calls, calls.malloc_calls, sizeof(st->malloc_calls));
+	memcpy(st->free_calls, calls.free_calls, sizeof(st->free_calls));
+	memcpy(st->realloc_calls, calls.realloc_calls, sizeof(st->realloc_calls));
+}
+
+/*********************************************************
+ * mm_stat - see mm_ext.h                                *
+ *********************************************************/
+int mm_stat(const char *name, size_t *value){
+	const char *dot = strchr(name, '.');
+	size_t len = (dot != NULL)? (size_t)(dot - name) : strlen(name);
+	unsigned int i, k;
+	mm_stats_t st;
+
+	for(i = 0; i < sizeof(stat_fields) / sizeof(stat_fields[0]); i++)
+		if(strlen(stat_fields[i].name) == len && strncmp(stat_fields[i].name, name, len) == 0)
+			break;
+	if(i == sizeof(stat_fields) / sizeof(stat_fields[0]))
+		return -1;
+	if(dot != NULL){	//one element of an array
+		char *end;
+		unsigned long index = strtoul(dot + 1, &end, 10);
+		if(end == dot + 1 || *end != '\0' || index >= stat_fields[i].count)
+			return -1;
+		mm_stats(&st);
+		*value = ((size_t *)((char *)&st + stat_fields[i].offset))[index];
+		return 0;
+	}
+	mm_stats(&st);
+	*value = 0;
+	for(k = 0; k < stat_fields[i].count; k++)	//an array without an index is summed
+		*value += ((size_t *)((char *)&st + stat_fields[i].offset))[k];
+	return 0;
+}
+
+/*********************************************************
+ * mm_stats_json - see mm_ext.h                          *
+ *********************************************************/
+int mm_stats_json(char *buf, size_t len){
+	unsigned int i, k;
+	size_t pos = 0;
+	mm_stats_t st;
+
+	mm_stats(&st);
+	json_printf(buf, len, &pos, "{");
+	for(i = 0; i < sizeof(stat_fields) / sizeof(stat_fields[0]); i++){
+		size_t *v = (size_t *)((char *)&st + stat_fields[i].offset);
+		json_printf(buf, len, &pos, "%s\"%s\": ", (i == 0)? "" : ", ", stat_fields[i].name);
+		if(stat_fields[i].count == 1){
+			json_printf(buf, len, &pos, "%lu", (unsigned long)v[0]);
+			continue;
+		}
+		for(k = 0; k < stat_fields[i].count; k++)
+			json_printf(buf, len, &pos, "%s%lu", (k == 0)? "[" : ", ", (unsigned long)v[k]);
+		json_printf(buf, len, &pos, "]");
+	}
+	json_printf(buf, len, &pos, "}\n");
+	return (int)pos;
+}
+
+/*********************************************************
+ * json_printf - snprintf at *pos of buf, advance *pos   *
+ * by what would have been written                       *
+ *********************************************************/
+static void json_printf(char *buf, size_t len, size_t *pos, const char *fmt, ...){
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf((*pos < len)? buf + *pos : NULL, (*pos < len)? len - *pos : 0, fmt, ap);
+	va_end(ap);
+	if(n > 0)
+		*pos += n;
+}
+
+/*********************************************************
+ * realloc - Change the size of the block in place when  *
+ * possible (see arena_realloc), otherwise by mallocing  *
+ * a new block, copying its data, and freeing the old one*
+ *********************************************************/
+void *realloc(void *oldptr, size_t size){
+	//printf("realloc called, oldptr = %lu, size = %u\n", (unsigned long)oldptr, (unsigned)size);	
+
+	size_t oldsize;
+	void *newptr;
+	int sampled = 0;
+
+	/* If oldptr is NULL, then this is just malloc. */
+	if(oldptr == NULL){
+		return malloc(size);
+	}
+
+	/* If size == 0 then this is just free, and we return NULL. */
+	if(size == 0){
+		free(oldptr);
+		return 0;
+	}
+	STAT_CALL(realloc_calls, STAT_CLASS(size));
+
+	/* Small objects stay where they are while their class is that of size, see free_sized */
+	arena_t *owner = arena_of(oldptr);
+	if(IS_SLAB(owner, oldptr)){
+		oldsize = slab_size[SLAB_OF(oldptr)->cls];
+		if(size <= SLAB_MAX && slab_class[(size + (ALIGNMENT - 1)) / ALIGNMENT] == SLAB_OF(oldptr)->cls)
+			return oldptr;
+	}
+	else if((sampled = IS_SAMPLED(oldptr)) != 0)	/* Sampled blocks move, the new one is sampled */
+		oldsize = malloc_usable_size(oldptr);
+	else if(IS_MMAPPED(oldptr)){	/* Mapped blocks move their pages, not their data */
+		if((newptr = mmap_realloc(oldptr, size)) != NULL)
+			return newptr;
+		oldsize = MMAP_LEN(oldptr) - MMAP_HSIZE;
+	}
+	else{	/* The header may only be read under the owner's lock */
+		arena_lock(owner);
+		newptr = arena_realloc(oldptr, size);
+		oldsize = GET_SIZE(HDRP(oldptr)) - WSIZE;
+		arena_unlock();
+		if(newptr != NULL)
+			return newptr;
+	}
+
+	newptr = sampled? prof_malloc(size, __builtin_return_address(0)) : malloc(size);
+
+	/* If realloc() fails the original block is left untouched  */
+	if(!newptr){
+		return 0;
+	}
+
+	/* Copy the old data. */
+	if(size < oldsize)
+		oldsize = size;
+	memcpy(newptr, oldptr, oldsize);
+
+	/* Free the old block. */
+	free(oldptr);
+
+	return newptr;
+}
+
+/*********************************************************
+ * reallocarray - realloc to nmemb * size bytes, ENOMEM  *
+ * and oldptr left alone if that overflows               *
+ *********************************************************/
+void *reallocarray(void *oldptr, size_t nmemb, size_t size){
+	if(size != 0 && nmemb > (size_t)-1 / size){
+		errno = ENOMEM;
+		return NULL;
+	}
+	return realloc(oldptr, nmemb * size);
+}
+
+/*********************************************************
+ * arena_realloc - resize block bp of the current arena  *
+ * in place: shrink by splitting off the tail, grow by   *
+ * absorbing the free block after it, extending the heap *
+ * first if that block (or bp itself) is the last one.   *
+ * return bp, or NULL if the caller has to copy          *
+ *********************************************************/
+static void *arena_realloc(void *bp, size_t size){
+	size_t asize = ASIZE(size);
+	size_t csize = GET_SIZE(HDRP(bp));
+	int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+	void *next = NEXT_BLKP(bp);
+
+	if(size > BLOCK_MAX - QSIZE)	//no header can hold it
+		return NULL;
+	CHECK_TICK();
+
+	//shrink: the tail goes to coalesce, which merges it with a free successor
+	if(asize <= csize){
+		if(csize - asize >= QSIZE){
+			arena->splits++;
+			PUT(HDRP(bp), PACK(asize, 1, prev_alloc));
+			next = NEXT_BLKP(bp);
+			PUT(HDRP(next), PACK(csize - asize, 0, 1));
+			PUT(FTRP(next), PACK(csize - asize, 0, 1));
+			coalesce(next);
+		}
+		return bp;
+	}
+
+	//grow at the end of the heap: extend so that the free successor is large enough
+	size_t nsize = GET_ALLOC(HDRP(next))? 0 : GET_SIZE(HDRP(next));
+	void *last = (nsize == 0)? next : NEXT_BLKP(next);
+	if(csize + nsize < asize && GET_SIZE(HDRP(last)) == 0){	//epilogue
+		if(grow_heap(asize - csize - nsize) == NULL)
+			return NULL;
+		nsize = GET_SIZE(HDRP(next));	//coalesced into the successor
+		prev_alloc = GET_PREV_ALLOC(HDRP(bp));	//a quick list flush may have freed the block before
+	}
+
+	//grow into the free successor
+	if(csize + nsize < asize)
+		return NULL;
+	bst_delete(next);
+	CHECK_ABSORB(next, bp);
+	csize += nsize;
+	if(csize - asize >= QSIZE){	//enough for split, the block after already knows its prev is free
+		arena->splits++;
+		PUT(HDRP(bp), PACK(asize, 1, prev_alloc));
+		next = NEXT_BLKP(bp);
+		PUT(HDRP(next), PACK(csize - asize, 0, 1));
+		PUT(FTRP(next), PACK(csize - asize, 0, 1));
+		bst_add(next);
+	}
+	else{
+		PUT(HDRP(bp), PACK(csize, 1, prev_alloc));
+		SET_PREV_ALLOC1(NEXT_BLKP(bp), 1);
+	}
+	if(NEXT_BLKP(bp) > arena->touched)
+		arena->touched = NEXT_BLKP(bp);
+	return bp;
+}
+
+/*********************************************************
+ * calloc - you may want to look at mm-naive.c           *
+ * This function is not tested by mdriver, but it is     *
+ * needed to run the traces.                             *
+ * a block taken from a clean free block only needs its *
+ * old links and footer cleared                          *
+ *********************************************************/
+void *calloc(size_t nmemb, size_t size){
+	//printf("calloc called, nmemb = %u, size = %u\n", (unsigned)nmemb, (unsigned)size);
+
+	size_t bytes;
+	void *newptr;
+	unsigned int clean;
+
+	if(size != 0 && nmemb > (size_t)-1 / size){	//nmemb * size overflows
+		errno = ENOMEM;
+		return NULL;
+	}
+	bytes = nmemb * size;
+
+	//small objects: clearing them costs less than finding out
+	if(bytes <= SLAB_MAX){
+		if((newptr = malloc(bytes)) != NULL)
+			memset(newptr, 0, bytes);
+		return newptr;
+	}
+
+	if(PROF_DUE(bytes)){
+		if((newptr = prof_malloc(bytes, __builtin_return_address(0))) != NULL)
+			memset(newptr, 0, bytes);
+		return newptr;
+	}
+	STAT_CALL(malloc_calls, STAT_CLASS(bytes));
+
+	//a fresh mapping is zero
+	if(bytes >= __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED))
+		return mmap_malloc(bytes);
+
+	arena_lock((thread_arena != NULL)? thread_arena : arena_attach());
+	newptr = arena_malloc(bytes, &clean);
+	if(newptr != NULL && clean){
+		memset(newptr, 0, LINK_BYTES);
+		PUT(FTRP(newptr), 0);	//where the old footer was, unless the block was split
+	}
+	arena_unlock();
+
+	if(newptr != NULL && !clean)
+		memset(newptr, 0, bytes);
+	return newptr;
+}
+
+/******************************************************************************************************
+ *                                        Aligned Allocation                                          *
+ * An alignment up to ALIGNMENT is what malloc gives anyway. Larger ones take a heap block placed by  *
+ * place_aligned at an aligned position of a free block, the leading slack goes back to the BST as a  *
+ * free block of its own. Such a block is an ordinary heap block, free and realloc take it as it is   *
+ * (realloc keeps the alignment only while it resizes in place). Slab objects and mappings only have  *
+ * the alignment of malloc, so aligned requests never use them.                                       *
+ ******************************************************************************************************/
+/*********************************************************
+ * posix_memalign, aligned_alloc, memalign - see mm_ext.h*
+ *********************************************************/
+int posix_memalign(void **memptr, size_t alignment, size_t size){
+	void *bp;
+
+	if(alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0)
+		return EINVAL;
+	if((bp = aligned_malloc(alignment, size)) == NULL)
+		return ENOMEM;
+	*memptr = bp;
+	return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size){
+	if(alignment == 0 || (alignment & (alignment - 1)) != 0){
+		errno = EINVAL;
+		return NULL;
+	}
+	return aligned_malloc(alignment, size);
+}
+
+void *memalign(size_t alignment, size_t size){
+	size_t align = ALIGNMENT;
+
+	while(align < alignment && align != 0)	//like glibc: round up to a power of two
+		align <<= 1;
+	if(align == 0){
+		errno = EINVAL;
+		return NULL;
+	}
+	return aligned_malloc(align, size);
+}
+
+/*********************************************************
+ * valloc, pvalloc - see mm_ext.h                        *
+ *********************************************************/
+void *valloc(size_t size){
+	return aligned_malloc(PAGESIZE, size);
+}
+
+void *pvalloc(size_t size){
+	if(size > (size_t)-1 - PAGESIZE){
+		errno = ENOMEM;
+		return NULL;
+	}
+	return aligned_malloc(PAGESIZE, ALIGN_UP(MAX(size, 1), PAGESIZE));
+}
+
+/*********************************************************
+ * aligned_malloc - malloc a payload aligned to align, a *
+ * power of two                                          *
+ *********************************************************/
+static void *aligned_malloc(size_t align, size_t size){
+	size_t asize;
+	void *bp;
+	int sample;
+
+	if(align <= ALIGNMENT)
+		return malloc(size);
+	if(align > BLOCK_MAX - QSIZE || size > BLOCK_MAX - QSIZE - align || align > HEAP_MAX){	//no header can hold it
+		errno = ENOMEM;
+		return NULL;
+	}
+	asize = ASIZE(MAX(size, 1));	//like malloc, an aligned block for size 0 as well
+	STAT_CALL(malloc_calls, STAT_CLASS(size));
+	sample = PROF_DUE(size);
+
+	arena_lock((thread_arena != NULL)? thread_arena : arena_attach());
+	if(arena->heap_listp == NULL && arena_init() == -1){
+		arena_unlock();
+		return NULL;
+	}
+	CHECK_TICK();
+	if((bp = find_fit_aligned(asize, align)) != NULL || (bp = grow_heap_aligned(asize, align)) != NULL)
+		bp = place_aligned(bp, asize, align);
+	if(sample && bp != NULL)
+		PUT(HDRP(bp), GET(HDRP(bp)) | SAMPLED);
+	arena_unlock();
+	if(sample && bp != NULL)
+		prof_record(bp, size, __builtin_return_address(0));
+	return bp;
+}
+
+/******************************************************************************************************
+ *                                          Lifetime Hints                                            *
+ * mm_malloc_hint keeps blocks that will live long and blocks that will soon go apart, so that the    *
+ * holes the short-lived ones leave merge with each other instead of being pinned between long-lived  *
+ * neighbours. Both take the best fit as malloc does, but a long-lived block is cut from the low end  *
+ * of it and a short-lived one from the high end, and the same goes for the top block when the heap   *
+ * grows: long-lived blocks pile up from the bottom of the free space, short-lived ones from its top. *
+ * A quick list block of the exact size is still taken first, it wastes nothing. Small objects and    *
+ * mappings ignore the hint: a slab is denser than any placement of heap blocks, and a mapping has no *
+ * neighbours. The lifetime profile of the heap profiler (mm_profile_lifetimes) tells which call      *
+ * sites allocate which kind of block.                                                                *
+ ******************************************************************************************************/
+/*********************************************************
+ * mm_malloc_hint - see mm_ext.h                         *
+ *********************************************************/
+void *mm_malloc_hint(size_t size, int hint){
+	size_t asize;
+	char *bp;
+
+	if(size <= SLAB_MAX || (hint != MM_SHORT_LIVED && hint != MM_LONG_LIVED)
+			|| size >= __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED))
+		return malloc(size);
+	if(PROF_DUE(size))
+		return prof_malloc(size, __builtin_return_address(0));
+	if(size > BLOCK_MAX - QSIZE){	//no header can hold it
+		errno = ENOMEM;
+		return NULL;
+	}
+	asize = ASIZE(size);
+	STAT_CALL(malloc_calls, STAT_CLASS(size));
+
+	arena_lock((thread_arena != NULL)? thread_arena : arena_attach());
+	if(arena->heap_listp == NULL && arena_init() == -1){
+		arena_unlock();
+		return NULL;
+	}
+	CHECK_TICK();
+	if(asize <= QUICK_MAX && (bp = arena->quick[asize / DSIZE]) != NULL){
+		arena->quick[asize / DSIZE] = *(void **)bp;
+		arena->quick_count[asize / DSIZE]--;
+		arena->quick_blocks--;
+		arena->quick_bytes -= asize;
+	}
+	else if((bp = find_fit(asize)) != NULL || (bp = grow_heap(asize)) != NULL){
+		if(hint == MM_SHORT_LIVED)
+			bp = place_tail(bp, asize);
+		else
+			place(bp, asize);
+	}
+	arena_unlock();
+	return bp;
+}
+
+/*********************************************************
+ * place_tail - Place block of asize bytes at the end of *
+ * free block bp, the front goes back to the BST; place  *
+ * if it would be too small for a block. return the      *
+ * block                                                 *
+ *********************************************************/
+static void *place_tail(void *bp, size_t asize){
+	size_t dif = GET_SIZE(HDRP(bp)) - asize;
+	int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+	unsigned int clean = GET_CLEAN(HDRP(bp));	//the front stays clean, its new footer lies in zeros
+	char *tbp;
+
+	if(dif < QSIZE){
+		place(bp, asize);
+		return bp;
+	}
+	bst_delete(bp);
+	arena->splits++;
+	PUT(HDRP(bp), PACK(dif, 0, prev_alloc) | clean);
+	PUT(FTRP(bp), PACK(dif, 0, prev_alloc) | clean);
+	bst_add(bp);
+	tbp = NEXT_BLKP(bp);
+	PUT(HDRP(tbp), PACK(asize, 1, 0));
+	SET_PREV_ALLOC1(NEXT_BLKP(tbp), 1);
+	if(NEXT_BLKP(tbp) > arena->touched)
+		arena->touched = NEXT_BLKP(tbp);
+	return tbp;
+}
+
+/******************************************************************************************************
+ *                                         Batch Allocation                                           *
+ * mm_malloc_batch takes n heap blocks of one size under a single lock, carved one after the other    *
+ * out of one free block that holds them all (best fit, else the largest, else a new top block), so   *
+ * the tree is touched once per free block used instead of once per block. mm_free_batch sorts the    *
+ * pointers by address and frees every run of blocks that lie next to each other in an arena as one   *
+ * block: one coalesce and one bst_add per run. Small objects and mappings take their usual path.     *
+ ******************************************************************************************************/
+/*********************************************************
+ * mm_malloc_batch - see mm_ext.h                        *
+ *********************************************************/
+size_t mm_malloc_batch(size_t size, size_t n, void **ptrs){
+	size_t done = 0, asize, k;
+	void *bp;
+
+	if(n == 0)
+		return 0;
+	if(size == 0)	//like malloc, blocks of their own
+		size = 1;
+	STAT_CALLS(malloc_calls, STAT_CLASS(size), n);
+
+	//small objects: the thread cache first, then the slabs of the arena
+	if(size <= SLAB_MAX){
+		int cls = slab_class[(size + (ALIGNMENT - 1)) / ALIGNMENT];
+		while(done < n && (bp = tcache[cls].head) != NULL){
+			tcache[cls].head = *(void **)bp;
+			tcache[cls].count--;
+			ptrs[done++] = bp;
+		}
+	}
+	else if(size >= __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED)){
+		while(done < n && (ptrs[done] = mmap_malloc(size)) != NULL)
+			done++;
+		return done;
+	}
+	if(done == n)
+		return n;
+
+	arena_lock((thread_arena != NULL)? thread_arena : arena_attach());
+	if(size <= SLAB_MAX || size > BLOCK_MAX - QSIZE || (arena->heap_listp == NULL && arena_init() == -1)){
+		while(done < n && (ptrs[done] = arena_malloc(size, NULL)) != NULL)
+			done++;
+		arena_unlock();
+		return done;
+	}
+	CHECK_TICK();
+	asize = ASIZE(size);
+	while(done < n){
+		k = MIN(n - done, BLOCK_MAX / asize);	//what one free block may hold
+		if((bp = find_fit(k * asize)) == NULL && ((bp = largest_free()) == NULL || GET_SIZE(HDRP(bp)) < asize)
+				&& (bp = grow_heap(k * asize)) == NULL && (k = 1, bp = grow_heap(asize)) == NULL)
+			break;
+		done += carve(bp, asize, k, ptrs + done);
+	}
+	arena_unlock();
+	return done;
+}
+
+/*********************************************************
+ * carve - take up to n allocated blocks of asize bytes  *
+ * from the front of free block bp, the rest stays free  *
+ * or, if too small for that, goes to the last block.    *
+ * return the number of blocks                           *
+ *********************************************************/
+static size_t carve(void *bp, size_t asize, size_t n, void **ptrs){
+	size_t csize = GET_SIZE(HDRP(bp));
+	int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+	unsigned int clean = GET_CLEAN(HDRP(bp));	//the remainder stays clean
+	size_t i, rest;
+	char *p = bp;
+
+	bst_delete(bp);
+	n = MIN(n, csize / asize);
+	rest = csize - n * asize;
+	for(i = 0; i < n; i++){
+		size_t bsize = (i == n - 1 && rest < QSIZE)? asize + rest : asize;
+		PUT(HDRP(p), PACK(bsize, 1, prev_alloc));
+		ptrs[i] = p;
+		prev_alloc = 1;
+		p += bsize;
+	}
+	arena->splits += n - 1;
+	if(rest >= QSIZE){
+		arena->splits++;
+		PUT(HDRP(p), PACK(rest, 0, 1) | clean);
+		PUT(FTRP(p), PACK(rest, 0, 1) | clean);
+		bst_add(p);
+	}
+	else
+		SET_PREV_ALLOC1(p, 1);
+	if(p > arena->touched)
+		arena->touched = p;
+	return n;
+}
+
+/*********************************************************
+ * largest_free - the largest free block of the current  *
+ * arena in the BST, NULL if there is none               *
+ *********************************************************/
+static void *largest_free(void){
+#ifdef MM_TLSF
+	return tlsf_largest();
+#endif
+	void *bp = arena->free_listp;
+
+	if(bp == NULL)
+		return NULL;
+	while(GET_RCO(bp) != 0)
+		bp = O2P(GET_RCO(bp));
+	return bp;
+}
+
+/*********************************************************
+ * mm_free_batch - see mm_ext.h                          *
+ *********************************************************/
+void mm_free_batch(void **ptrs, size_t n){
+	size_t i, j;
+
+	if(thread_arena == NULL)
+		arena_attach();
+
+	//small objects and mappings the usual way, before any lock is held; heap blocks to the front
+	for(i = j = 0; i < n; i++){
+		if(ptrs[i] == NULL)
+			continue;
+		if(IS_SLAB(arena_of(ptrs[i]), ptrs[i]) || IS_MMAPPED(ptrs[i]))
+			free(ptrs[i]);
+		else{
+			PROF_FREE(ptrs[i]);
+			ptrs[j++] = ptrs[i];
+		}
+	}
+	n = j;
+	sort_addr(ptrs, n);
+
+	//runs of neighbours in the heap of one arena
+	for(i = 0; i < n; i = j){
+		arena_t *owner = arena_of(ptrs[i]);
+		arena_lock(owner);
+		for(j = i; j < n && arena_of(ptrs[j]) == owner; ){
+			char *bp = ptrs[j];
+			size_t size = GET_SIZE(HDRP(bp));
+			STAT_CALL(free_calls, STAT_CLASS(size - WSIZE));
+			while(++j < n && ptrs[j] == bp + size && size + GET_SIZE(HDRP(ptrs[j])) <= BLOCK_MAX){
+				STAT_CALL(free_calls, STAT_CLASS(GET_SIZE(HDRP(ptrs[j])) - WSIZE));
+				CHECK_ABSORB(ptrs[j], bp);	//the sampled checker must not resume inside the run
+				size += GET_SIZE(HDRP(ptrs[j]));
+			}
+			arena_free_run(bp, size);
+		}
+		arena_unlock();
+	}
+}
+
+/*********************************************************
+ * sort_addr - sort n pointers by address in place: radix*
+ * sort on the top 8 bits of their offset from the lowest*
+ * one, then every bucket on its own. qsort takes about  *
+ * five times as long for a batch of heap blocks         *
+ *********************************************************/
+static void sort_addr(void **ptrs, size_t n){
+	unsigned int next[256], end[256];	//of the part of each bucket not yet in place
+	unsigned int b, d, shift = 0;
+	char *lo, *hi;
+	size_t i, j;
+
+	if(n <= 32){	//insertion sort
+		for(i = 1; i < n; i++){
+			void *v = ptrs[i];
+			for(j = i; j > 0 && (char *)ptrs[j - 1] > (char *)v; j--)
+				ptrs[j] = ptrs[j - 1];
+			ptrs[j] = v;
+		}
+		return;
+	}
+	lo = hi = ptrs[0];
+	for(i = 1; i < n; i++){
+		lo = MIN(lo, (char *)ptrs[i]);
+		hi = MAX(hi, (char *)ptrs[i]);
+	}
+	while((size_t)(hi - lo) >> shift > 255)
+		shift++;
+
+	memset(end, 0, sizeof(end));
+	for(i = 0; i < n; i++)
+		end[((char *)ptrs[i] - lo) >> shift]++;
+	for(b = 0, i = 0; b < 256; b++){
+		next[b] = i;
+		i += end[b];
+		end[b] = i;
+	}
+	for(b = 0; b < 256; b++)	//put every pointer into its bucket, following the cycles
+		while(next[b] < end[b]){
+			void *v = ptrs[next[b]];
+			while((d = ((char *)v - lo) >> shift) != b){
+				void *t = ptrs[next[d]];
+				ptrs[next[d]++] = v;
+				v = t;
+			}
+			ptrs[next[b]++] = v;
+		}
+	for(b = 0, i = 0; b < 256; i = end[b++])
+		if(end[b] - i > 1 && shift != 0)
+			sort_addr(ptrs + i, end[b] - i);
+}
+
+/******************************************************************************************************
+ *                                         Persistent Heaps                                           *
+ * A persistent heap is an arena whose heap lies in a file mapped with MAP_SHARED: page 0 holds a     *
+ * pheap_hdr_t, the heap follows. Free blocks link through offsets from heap_listp, so apart from the *
+ * roots of the BST and min_listp, which the header keeps as offsets too, the heap is the same at any *
+ * address and a process that opens the file finds every block where it was. Nothing in such a heap   *
+ * may hold a pointer, so it has no slabs and no quick lists, and as madvise does not zero the pages  *
+ * of a file, it is never trimmed or scavenged either. The arena itself lives in anonymous memory and *
+ * is not one of arenas[]. The header's offsets are written on sync and close; a heap still marked    *
+ * open was not closed, and is rebuilt by walking its blocks.                                         *
+ ******************************************************************************************************/
+struct mm_pheap{
+	arena_t arena;
+	int fd;
+	size_t maplen;	//header page and heap
+};
+
+/*********************************************************
+ * mm_pheap_open - see mm_ext.h                          *
+ *********************************************************/
+mm_pheap_t *mm_pheap_open(const char *path, size_t size){
+	struct mm_pheap *h;
+	pheap_hdr_t *hdr;
+	struct stat st;
+	size_t maplen;
+	char *map;
+	int fd, created, err;
+
+	if((fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) == -1)
+		return NULL;
+	if(flock(fd, LOCK_EX | LOCK_NB) == -1 || fstat(fd, &st) == -1)	//one process at a time
+		goto fail_fd;
+	created = (st.st_size == 0);
+	size = ALIGN_UP(size, PAGESIZE);
+	if(created && (size == 0 || size > HEAP_MAX)){
+		errno = EINVAL;
+		goto fail_fd;
+	}
+	if(created && ftruncate(fd, PAGESIZE + size) == -1)	//sparse, reads as zero
+		goto fail_fd;
+	maplen = created? PAGESIZE + size : (size_t)st.st_size;
+	if(maplen <= PAGESIZE){
+		errno = EINVAL;
+		goto fail_fd;
+	}
+	if((map = mmap(NULL, maplen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+		goto fail_fd;
+	hdr = (pheap_hdr_t *)map;
+	if(!created && (memcmp(hdr->magic, PHEAP_MAGIC, sizeof(hdr->magic)) != 0 || hdr->version != PHEAP_VERSION
+			|| hdr->word_size != WSIZE || hdr->offset_shift != OFFSET_SHIFT || hdr->size != maplen - PAGESIZE)){
+		errno = EINVAL;	//not a heap, or one of another build
+		goto fail_map;
+	}
+	h = mmap(NULL, sizeof(*h), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(h == MAP_FAILED)
+		goto fail_map;
+	pthread_mutex_init(&h->arena.lock, NULL);	//everything else is zero
+	h->fd = fd;
+	h->maplen = maplen;
+	h->arena.pheap = hdr;
+	h->arena.lo = h->arena.brk = h->arena.fresh = map + PAGESIZE;
+	h->arena.end = map + maplen;
+
+	arena_lock(&h->arena);
+	if(created){
+		memcpy(hdr->magic, PHEAP_MAGIC, sizeof(hdr->magic));
+		hdr->version = PHEAP_VERSION;
+		hdr->word_size = WSIZE;
+		hdr->offset_shift = OFFSET_SHIFT;
+		hdr->size = size;
+		err = arena_init();
+	}
+	else{	//everything is in place, only the pointers of the arena are made from the offsets
+		arena->heap_listp = arena->lo + 2 * WSIZE;
+		arena->slab_base = (char *)ALIGN_DOWN(arena->heap_listp, PAGESIZE);
+		arena->grow_shift = GROW_SHIFT;
+		if(hdr->open || !PHEAP_HAS_LISTS(hdr))	//crashed, or the free lists are not in the file
+			err = pheap_rebuild();
+		else{
+			arena->brk = arena->lo + hdr->brk;
+			arena->free_listp = (hdr->free_root != 0)? (char *)arena->heap_listp + hdr->free_root : NULL;
+			arena->min_listp = (hdr->min_list != 0)? (char *)arena->heap_listp + hdr->min_list : NULL;
+			arena->free_bytes = hdr->free_bytes;
+			arena->free_blocks = hdr->free_blocks;
+#ifdef MM_SIZE_INDEX
+			if(arena->free_listp != NULL)	//the index lives out of the file
+				idx_build(P2O(arena->free_listp));
+#endif
+			err = 0;
+		}
+		arena->fresh = arena->touched = arena->brk;	//never trimmed: above brk is still zero
+	}
+	hdr->open = 1;
+#ifdef MM_SIZE_INDEX
+	if(err != 0)
+		idx_release();
+#endif
+	arena_unlock();
+	if(err == 0)
+		return h;
+
+	munmap(h, sizeof(*h));
+	errno = EIO;
+fail_map:
+	err = errno;
+	munmap(map, maplen);
+	errno = err;
+fail_fd:
+	err = errno;
+	close(fd);
+	errno = err;
+	return NULL;
+}
+
+/*********************************************************
+ * pheap_rebuild - rebuild the BST of the persistent     *
+ * heap of the current arena from its blocks, return 0   *
+ * or -1 if they do not check out                        *
+ *********************************************************/
+static int pheap_rebuild(void){
+	char *bp = arena->heap_listp;
+	size_t size;
+
+	arena->free_listp = arena->min_listp = NULL;
+	arena->free_bytes = arena->free_blocks = 0;
+#ifdef MM_SIZE_INDEX
+	idx_reset();
+#endif
+#ifdef MM_TLSF
+	tlsf_reset();
+#endif
+	if(GET(HDRP(bp)) != PACK(DSIZE, 1, 1))
+		return -1;
+	for(bp = NEXT_BLKP(bp); (size = GET_SIZE(HDRP(bp))) != 0; bp = NEXT_BLKP(bp)){
+		if(size % DSIZE != 0 || size > (size_t)(arena->end - (char *)bp))
+			return -1;
+		if(!GET_ALLOC(HDRP(bp)))
+			bst_add(bp);
+	}
+	arena->brk = bp;	//right after the epilogue header
+	return (arena_validate(NULL) == MM_CHECK_OK)? 0 : -1;
+}
+
+/*********************************************************
+ * pheap_sync - write the offsets of the current arena   *
+ * to the header of its persistent heap                  *
+ *********************************************************/
+static void pheap_sync(void){
+	pheap_hdr_t *hdr = arena->pheap;
+
+	hdr->brk = arena->brk - arena->lo;
+	hdr->free_root = (arena->free_listp != NULL)? (size_t)((char *)arena->free_listp - (char *)arena->heap_listp) : 0;
+	hdr->min_list = (arena->min_listp != NULL)? (size_t)((char *)arena->min_listp - (char *)arena->heap_listp) : 0;
+	hdr->free_bytes = arena->free_bytes;
+	hdr->free_blocks = arena->free_blocks;
+}
+
+/*********************************************************
+ * mm_pheap_sync, mm_pheap_close - see mm_ext.h          *
+ *********************************************************/
+int mm_pheap_sync(mm_pheap_t *h){
+	int ret;
+
+	arena_lock(&h->arena);
+	pheap_sync();
+	ret = msync(h->arena.pheap, h->maplen, MS_SYNC);
+	arena_unlock();
+	return ret;
+}
+
+int mm_pheap_close(mm_pheap_t *h){
+	int ret;
+
+	arena_lock(&h->arena);
+	pheap_sync();
+	h->arena.pheap->open = 0;
+	ret = msync(h->arena.pheap, h->maplen, MS_SYNC);
+#ifdef MM_SIZE_INDEX
+	idx_release();
+#endif
+	arena_unlock();
+	munmap(h->arena.pheap, h->maplen);
+	close(h->fd);
+	munmap(h, sizeof(*h));
+	return ret;
+}
+
+/*********************************************************
+ * mm_pheap_malloc, mm_pheap_free - see mm_ext.h         *
+ *********************************************************/
+void *mm_pheap_malloc(mm_pheap_t *h, size_t size){
+	void *bp;
+
+	if(size == 0)	//like malloc, a block of its own that may be freed
+		size = 1;
+	arena_lock(&h->arena);
+	bp = arena_malloc(size, NULL);
+	arena_unlock();
+	return bp;
+}
+
+void mm_pheap_free(mm_pheap_t *h, void *bp){
+	if(bp == NULL)
+		return;
+	arena_lock(&h->arena);
+	arena_free(bp);
+	arena_unlock();
+}
+
+/*********************************************************
+ * mm_pheap_base, mm_pheap_root, mm_pheap_set_root - see *
+ * mm_ext.h                                              *
+ *********************************************************/
+void *mm_pheap_base(mm_pheap_t *h){
+	return h->arena.lo;
+}
+
+void *mm_pheap_root(mm_pheap_t *h){
+	size_t root = __atomic_load_n(&h->arena.pheap->root, __ATOMIC_ACQUIRE);
+
+	return (root != 0)? h->arena.lo + root : NULL;
+}
+
+void mm_pheap_set_root(mm_pheap_t *h, void *p){
+	__atomic_store_n(&h->arena.pheap->root, (p != NULL)? (size_t)((char *)p - h->arena.lo) : 0, __ATOMIC_RELEASE);
+}
+
+/******************************************************************************************************
+ *                                           Heap Handles                                             *
+ * A heap handle is an arena of its own, made by arena_create like those of threads but not one of    *
+ * arenas[]: threads never attach to it and free does not find it, so its blocks go back through the  *
+ * handle. It has its own reservation of ARENA_SIZE bytes, so no two heaps share a page, let alone a  *
+ * cache line. It takes no thread cache and no mapping of its own for large blocks: every block lies  *
+ * in the heap, and a reset drops all of them at once by making the heap empty again with            *
+ * arena_init, which costs the same however many blocks there were.                                  *
+ ******************************************************************************************************/
+struct mm_heap{
+	arena_t arena;
+};
+
+/*********************************************************
+ * mm_heap_create, mm_heap_destroy, mm_heap_reset - see  *
+ * mm_ext.h                                              *
+ *********************************************************/
+mm_heap_t *mm_heap_create(void){
+	return (mm_heap_t *)arena_create();	//the heap is created on first use
+}
+
+void mm_heap_destroy(mm_heap_t *h){
+#ifdef MM_SIZE_INDEX
+	arena_lock(&h->arena);
+	idx_release();
+	arena_unlock();
+#endif
+	pthread_mutex_destroy(&h->arena.lock);
+	munmap(h, ALIGN_UP(sizeof(arena_t), PAGESIZE) + ARENA_SIZE);
+}
+
+void mm_heap_reset(mm_heap_t *h){
+	arena_lock(&h->arena);
+	if(arena->heap_listp != NULL)
+		arena_init();	//cannot fail, the first bytes of the reservation are there
+	arena_unlock();
+}
+
+/*********************************************************
+ * mm_heap_malloc, mm_heap_free - see mm_ext.h           *
+ *********************************************************/
+void *mm_heap_malloc(mm_heap_t *h, size_t size){
+	void *bp;
+
+	if(size == 0)	//like malloc, a block of its own that may be freed
+		size = 1;
+	arena_lock(&h->arena);
+	bp = arena_malloc(size, NULL);
+	arena_unlock();
+	return bp;
+}
+
+void mm_heap_free(mm_heap_t *h, void *bp){
+	if(bp == NULL)
+		return;
+	arena_lock(&h->arena);
+	arena_free(bp);
+	arena_unlock();
+}
+
+/*********************************************************
+ * mm_heap_realloc - see mm_ext.h, realloc under a       *
+ * single lock of the heap                               *
+ *********************************************************/
+void *mm_heap_realloc(mm_heap_t *h, void *bp, size_t size){
+	size_t oldsize;
+	void *newptr;
+
+	if(size == 0){
+		mm_heap_free(h, bp);
+		return NULL;
+	}
+	if(bp == NULL)
+		return mm_heap_malloc(h, size);
+
+	arena_lock(&h->arena);
+	if(IS_SLAB(arena, bp)){	//small objects stay while their class is that of size
+		oldsize = slab_size[SLAB_OF(bp)->cls];
+		newptr = (size <= SLAB_MAX && slab_class[(size + (ALIGNMENT - 1)) / ALIGNMENT] == SLAB_OF(bp)->cls)? bp : NULL;
+	}
+	else{
+		newptr = arena_realloc(bp, size);
+		oldsize = GET_SIZE(HDRP(bp)) - WSIZE;
+	}
+	if(newptr == NULL && (newptr = arena_malloc(size, NULL)) != NULL){
+		memcpy(newptr, bp, MIN(size, oldsize));
+		arena_free(bp);
+	}
+	arena_unlock();
+	return newptr;
+}
+
+/*********************************************************
+ * mm_heap_memalign - see mm_ext.h, aligned_malloc on    *
+ * the arena of the heap                                 *
+ *********************************************************/
+void *mm_heap_memalign(mm_heap_t *h, size_t align, size_t size){
+	size_t asize;
+	void *bp;
+
+	if(align <= ALIGNMENT)
+		return mm_heap_malloc(h, size);
+	if((align & (align - 1)) != 0){
+		errno = EINVAL;
+		return NULL;
+	}
+	if(align > BLOCK_MAX - QSIZE || size > BLOCK_MAX - QSIZE - align || align > HEAP_MAX){	//no header can hold it
+		errno = ENOMEM;
+		return NULL;
+	}
+	asize = ASIZE(MAX(size, 1));	//like mm_heap_malloc, an aligned block for size 0 as well
+
+	arena_lock(&h->arena);
+	if(arena->heap_listp == NULL && arena_init() == -1){
+		arena_unlock();
+		return NULL;
+	}
+	if((bp = find_fit_aligned(asize, align)) != NULL || (bp = grow_heap_aligned(asize, align)) != NULL)
+		bp = place_aligned(bp, asize, align);
+	arena_unlock();
+	return bp;
+}
+
+/*********************************************************
+ * mm_heap_set_grow_step - see mm_ext.h                  *
+ *********************************************************/
+void mm_heap_set_grow_step(mm_heap_t *h, size_t bytes){
+	arena_lock(&h->arena);
+	arena->grow_step = bytes;
+	arena_unlock();
+}
+
+/******************************************************************************************************
+ *                                           Heap Profiler                                            *
+ * Sampling works as in tcmalloc. Every thread counts down the bytes it asks for in prof_left, and    *
+ * the allocation that takes the count below zero is sampled; the next distance is drawn from an      *
+ * exponential distribution with a mean of prof_rate bytes, so an allocation of s bytes is sampled    *
+ * with a probability of 1 - exp(-s / prof_rate), which pprof undoes for a heap_v2 profile. While the *
+ * profiler is off the count still runs down, then starts over at PROF_RECHECK bytes: a malloc pays   *
+ * one decrement. A sampled block is a heap block (or a mapping), never a small object, with the      *
+ * SAMPLED bit in its header, so free only looks for a sample when the bit is set. The stack comes    *
+ * from the unwinder of libgcc, from the return address of malloc on, so the frames of the allocator  *
+ * are left out. Every distinct stack is kept once with the sampled allocations made from it, the     *
+ * samples by address in a second table; both are mappings of their own that grow by doubling, and    *
+ * the profiler never calls malloc. For the lifetimes, prof_clock advances by prof_rate with every    *
+ * sample, an estimate of the bytes all threads have allocated; a sample keeps the clock at its       *
+ * birth, its stack the sum of the lifetimes of its freed samples and of the births of its live ones. *
+ ******************************************************************************************************/
+/*********************************************************
+ * prof_due - a thread's count ran out: draw the next    *
+ * distance. return whether the allocation is sampled    *
+ *********************************************************/
+static int prof_due(void){
+	size_t rate = __atomic_load_n(&prof_rate, __ATOMIC_RELAXED);
+
+	if(rate == 0){
+		prof_left = PROF_RECHECK;
+		return 0;
+	}
+	prof_left = prof_distance(rate);
+	return !prof_busy;
+}
+
+/*********************************************************
+ * prof_distance - bytes to the next sample, drawn from  *
+ * an exponential distribution with a mean of rate bytes *
+ * by way of a 26-bit uniform number and a log2 that is  *
+ * off by less than 0.01, without libm                   *
+ *********************************************************/
+static long prof_distance(size_t rate){
+	unsigned long x = prof_seed;
+	unsigned long r;
+	double f;
+	int e;
+
+	if(x == 0)
+		x = ((size_t)&prof_seed * 0x9e3779b97f4a7c15ul) | 1;
+	x ^= x << 13;	//xorshift64
+	x ^= x >> 7;
+	x ^= x << 17;
+	prof_seed = x;
+	r = (x >> 38) + 1;	//1 to 1 << 26
+	e = 63 - __builtin_clzl(r);
+	f = (double)(r - (1ul << e)) / (1ul << e);	//log2(r) = e + log2(1 + f), about e + f * (4 - f) / 3
+	return (long)((26 - e - f * (4 - f) / 3) * 0.6931471805599453 * rate) + 1;
+}
+
+/*********************************************************
+ * prof_malloc - malloc size bytes as a sampled block,   *
+ * a heap block (or a mapping) even if it is small, and  *
+ * record it with the stack from caller on               *
+ *********************************************************/
+static void *prof_malloc(size_t size, const void *caller){
+	void *bp;
+
+	if(__atomic_load_n(&prof_rate, __ATOMIC_RELAXED) == 0)	//turned off since
+		return malloc(size);
+	STAT_CALL(malloc_calls, STAT_CLASS(size));
+	if(size >= __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED)){
+		if((bp = mmap_malloc(size)) != NULL)
+			PUT(HDRP(bp), GET(HDRP(bp)) | SAMPLED);
+	}
+	else{
+		arena_lock((thread_arena != NULL)? thread_arena : arena_attach());
+		if((bp = arena_malloc(MAX(size, SLAB_MAX + 1), NULL)) != NULL)	//free looks for the bit of a heap block only
+			PUT(HDRP(bp), GET(HDRP(bp)) | SAMPLED);
+		arena_unlock();
+	}
+	if(bp != NULL)
+		prof_record(bp, size, caller);
+	return bp;
+}
+
+typedef struct{	//the state of prof_frame
+	void **pc;
+	unsigned int depth;
+	const void *caller;	//frames before this one are the allocator's
+} prof_walk_t;
+
+/*********************************************************
+ * prof_frame - one frame for _Unwind_Backtrace          *
+ *********************************************************/
+static _Unwind_Reason_Code prof_frame(struct _Unwind_Context *ctx, void *arg){
+	prof_walk_t *w = arg;
+	void *pc = (void *)_Unwind_GetIP(ctx);
+
+	if(pc == NULL)
+		return _URC_END_OF_STACK;
+	if(w->depth == 0 && pc != w->caller)
+		return _URC_NO_REASON;
+	w->pc[w->depth++] = pc;
+	return (w->depth == PROF_DEPTH)? _URC_END_OF_STACK : _URC_NO_REASON;
+}
+
+/*********************************************************
+ * prof_record - keep a sample of block bp of size bytes *
+ * with the stack from caller on                         *
+ *********************************************************/
+static void prof_record(void *bp, size_t size, const void *caller){
+	void *pc[PROF_DEPTH];
+	prof_walk_t w = {pc, 0, caller};
+	size_t i, s;
+
+	prof_busy = 1;	//in case the unwinder allocates
+	_Unwind_Backtrace(prof_frame, &w);
+	if(w.depth == 0){	//no unwind information, or caller is not a return address of this stack
+		pc[0] = (void *)caller;
+		w.depth = 1;
+	}
+
+	pthread_mutex_lock(&prof_lock);
+	if(prof_rate != 0 && (s = prof_stack_of(pc, w.depth)) != (size_t)-1
+			&& (prof_sample_count + 1 <= prof_sample_cap / 2 || prof_grow_samples() == 0)){
+		i = prof_sample_slot(bp);
+		if(prof_samples[i].bp == bp){	//left over from a heap that mm_init dropped
+			prof_stacks[prof_samples[i].stack].live_count--;
+			prof_stacks[prof_samples[i].stack].live_bytes -= prof_samples[i].size;
+			prof_stacks[prof_samples[i].stack].live_born -= prof_samples[i].born;
+		}
+		else
+			prof_sample_count++;
+		prof_clock += prof_rate;
+		prof_samples[i].bp = bp;
+		prof_samples[i].size = size;
+		prof_samples[i].stack = s;
+		prof_samples[i].born = prof_clock;
+		prof_stacks[s].live_count++;
+		prof_stacks[s].live_bytes += size;
+		prof_stacks[s].live_born += prof_clock;
+		prof_stacks[s].alloc_count++;
+		prof_stacks[s].alloc_bytes += size;
+	}
+	pthread_mutex_unlock(&prof_lock);
+	prof_busy = 0;
+}
+
+/*********************************************************
+ * prof_free - drop the sample of block bp, if there is  *
+ * one still                                             *
+ *********************************************************/
+static void prof_free(void *bp){
+	prof_stack_t *st;
+	size_t i;
+
+	pthread_mutex_lock(&prof_lock);
+	if(prof_sample_count != 0 && prof_samples[i = prof_sample_slot(bp)].bp == bp){
+		st = &prof_stacks[prof_samples[i].stack];
+		st->live_count--;
+		st->live_bytes -= prof_samples[i].size;
+		st->live_born -= prof_samples[i].born;
+		st->freed_count++;
+		st->freed_life += prof_clock - prof_samples[i].born;
+		prof_sample_remove(i);
+	}
+	pthread_mutex_unlock(&prof_lock);
+}
+
+/*********************************************************
+ * prof_stack_of - the entry of the stack of depth pcs,  *
+ * added if it is new. return -1 if the table is full    *
+ * and cannot grow                                       *
+ *********************************************************/
+static size_t prof_stack_of(void **pc, unsigned int depth){
+	size_t hash = 14695981039346656037ul;
+	size_t i;
+	unsigned int k;
+
+	for(k = 0; k < depth; k++)
+		hash = (hash ^ (size_t)pc[k]) * 1099511628211ul;
+	hash += (hash == 0);
+	if(prof_stack_count + 1 > prof_stack_cap / 2 && prof_grow_stacks() != 0)
+		return -1;
+	for(i = hash & (prof_stack_cap - 1); prof_stacks[i].hash != 0; i = (i + 1) & (prof_stack_cap - 1))
+		if(prof_stacks[i].hash == hash && prof_stacks[i].depth == depth
+				&& memcmp(prof_stacks[i].pc, pc, depth * sizeof(void *)) == 0)
+			return i;
+	prof_stacks[i].hash = hash;
+	prof_stacks[i].depth = depth;
+	memcpy(prof_stacks[i].pc, pc, depth * sizeof(void *));
+	prof_stack_count++;
+	return i;
+}
+
+/*********************************************************
+ * prof_sample_slot - the entry of block bp, or the      *
+ * unused one where it would go                          *
+ *********************************************************/
+static size_t prof_sample_slot(const void *bp){
+	size_t i;
+
+	for(i = PROF_HASH(bp) & (prof_sample_cap - 1); prof_samples[i].bp != NULL && prof_samples[i].bp != bp;
+			i = (i + 1) & (prof_sample_cap - 1));
+	return i;
+}
+
+/*********************************************************
+ * prof_sample_remove - remove entry i, moving back the  *
+ * entries after it that would not be found otherwise    *
+ *********************************************************/
+static void prof_sample_remove(size_t i){
+	size_t mask = prof_sample_cap - 1;
+	size_t j, home;
+
+	for(j = (i + 1) & mask; prof_samples[j].bp != NULL; j = (j + 1) & mask){
+		home = PROF_HASH(prof_samples[j].bp) & mask;
+		if(((j - home) & mask) >= ((j - i) & mask)){	//i lies between home and j
+			prof_samples[i] = prof_samples[j];
+			i = j;
+		}
+	}
+	prof_samples[i].bp = NULL;
+	prof_sample_count--;
+}
+
+/*********************************************************
+ * prof_grow_stacks, prof_grow_samples - map a table     *
+ * twice the size and move the entries over. return -1   *
+ * if the mapping fails                                  *
+ *********************************************************/
+static int prof_grow_stacks(void){
+	size_t cap = (prof_stack_cap != 0)? 2 * prof_stack_cap : PROF_TABLE_MIN;
+	prof_stack_t *old = prof_stacks, *t;
+	size_t i, k;
+
+	t = mmap(NULL, cap * sizeof(prof_stack_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(t == MAP_FAILED)
+		return -1;
+	for(i = 0; i < prof_stack_cap; i++)
+		if(old[i].hash != 0){
+			for(k = old[i].hash & (cap - 1); t[k].hash != 0; k = (k + 1) & (cap - 1));
+			t[k] = old[i];
+		}
+	for(i = 0; i < prof_sample_cap; i++)	//the samples know their stack by index
+		if(prof_samples[i].bp != NULL){
+			for(k = old[prof_samples[i].stack].hash & (cap - 1); t[k].hash != old[prof_samples[i].stack].hash
+					|| t[k].depth != old[prof_samples[i].stack].depth || memcmp(t[k].pc,
+					old[prof_samples[i].stack].pc, t[k].depth * sizeof(void *)) != 0; k = (k + 1) & (cap - 1));
+			prof_samples[i].stack = k;
+		}
+	if(old != NULL)
+		munmap(old, prof_stack_cap * sizeof(prof_stack_t));
+	prof_stacks = t;
+	prof_stack_cap = cap;
+	return 0;
+}
+
+static int prof_grow_samples(void){
+	size_t cap = (prof_sample_cap != 0)? 2 * prof_sample_cap : PROF_TABLE_MIN;
+	prof_sample_t *old = prof_samples, *t;
+	size_t i, k;
+
+	t = mmap(NULL, cap * sizeof(prof_sample_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(t == MAP_FAILED)
+		return -1;
+	for(i = 0; i < prof_sample_cap; i++)
+		if(old[i].bp != NULL){
+			for(k = PROF_HASH(old[i].bp) & (cap - 1); t[k].bp != NULL; k = (k + 1) & (cap - 1));
+			t[k] = old[i];
+		}
+	if(old != NULL)
+		munmap(old, prof_sample_cap * sizeof(prof_sample_t));
+	prof_samples = t;
+	prof_sample_cap = cap;
+	return 0;
+}
+
+/*********************************************************
+ * prof_drop_all - unmap both tables                     *
+ *********************************************************/
+static void prof_drop_all(void){
+	if(prof_stacks != NULL)
+		munmap(prof_stacks, prof_stack_cap * sizeof(prof_stack_t));
+	if(prof_samples != NULL)
+		munmap(prof_samples, prof_sample_cap * sizeof(prof_sample_t));
+	prof_stacks = NULL;
+	prof_samples = NULL;
+	prof_stack_cap = prof_stack_count = prof_sample_cap = prof_sample_count = 0;
+	prof_clock = 0;
+}
+
+/*********************************************************
+ * mm_set_profile - see mm_ext.h                         *
+ *********************************************************/
+void mm_set_profile(size_t bytes){
+	bytes = MIN(bytes, PROF_RATE_MAX);
+	pthread_mutex_lock(&prof_lock);
+	if(bytes == 0)
+		prof_drop_all();
+	__atomic_store_n(&prof_rate, bytes, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&prof_lock);
+	prof_left = (bytes != 0)? prof_distance(bytes) : PROF_RECHECK;	//other threads notice within PROF_RECHECK bytes
+}
+
+/*********************************************************
+ * mm_profile_dump - see mm_ext.h                        *
+ * the legacy text format of gperftools, which pprof     *
+ * reads: a header with the totals and the sample rate,  *
+ * a line per stack, then the mappings of the process    *
+ *********************************************************/
+int mm_profile_dump(const char *path){
+	char buf[4096];
+	size_t pos = 0, live_count = 0, live_bytes = 0, alloc_count = 0, alloc_bytes = 0, i;
+	unsigned int k;
+	ssize_t n;
+	int fd, maps, err = 0;
+
+	if((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+		return -1;
+	pthread_mutex_lock(&prof_lock);
+	for(i = 0; i < prof_stack_cap; i++){
+		live_count += prof_stacks[i].live_count;
+		live_bytes += prof_stacks[i].live_bytes;
+		alloc_count += prof_stacks[i].alloc_count;
+		alloc_bytes += prof_stacks[i].alloc_bytes;
+	}
+	err |= prof_printf(fd, buf, &pos, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n",
+		live_count, live_bytes, alloc_count, alloc_bytes, prof_rate);
+	for(i = 0; i < prof_stack_cap; i++){
+		if(prof_stacks[i].hash == 0)
+			continue;
+		err |= prof_printf(fd, buf, &pos, "%zu: %zu [%zu: %zu] @", prof_stacks[i].live_count,
+			prof_stacks[i].live_bytes, prof_stacks[i].alloc_count, prof_stacks[i].alloc_bytes);
+		for(k = 0; k < prof_stacks[i].depth; k++)
+			err |= prof_printf(fd, buf, &pos, " %p", prof_stacks[i].pc[k]);
+		err |= prof_printf(fd, buf, &pos, "\n");
+	}
+	pthread_mutex_unlock(&prof_lock);
+
+	//what pprof needs to find the symbols
+	err |= prof_printf(fd, buf, &pos, "\nMAPPED_LIBRARIES:\n");
+	err |= prof_flush(fd, buf, &pos);
+	if((maps = open("/proc/self/maps", O_RDONLY)) != -1){
+		while((n = read(maps, buf, sizeof(buf))) > 0)
+			if(write(fd, buf, n) != n)
+				err = -1;
+		close(maps);
+	}
+	if(close(fd) != 0)
+		err = -1;
+	return err;
+}
+
+/*********************************************************
+ * mm_profile_lifetimes - see mm_ext.h                   *
+ *********************************************************/
+int mm_profile_lifetimes(const char *path){
+	char buf[4096];
+	size_t pos = 0, i;
+	unsigned int k;
+	prof_stack_t *st;
+	int fd, err = 0;
+
+	if((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+		return -1;
+	pthread_mutex_lock(&prof_lock);
+	err |= prof_printf(fd, buf, &pos, "lifetimes: %zu @ %zu\n", prof_clock, prof_rate);
+	for(i = 0; i < prof_stack_cap; i++){
+		st = &prof_stacks[i];
+		if(st->hash == 0)
+			continue;
+		err |= prof_printf(fd, buf, &pos, "%zu: %zu [%zu: %zu] @", st->freed_count,
+			(st->freed_count != 0)? st->freed_life / st->freed_count : 0, st->live_count,
+			(st->live_count != 0)? prof_clock - st->live_born / st->live_count : 0);
+		for(k = 0; k < st->depth; k++)
+			err |= prof_printf(fd, buf, &pos, " %p", st->pc[k]);
+		err |= prof_printf(fd, buf, &pos, "\n");
+	}
+	pthread_mutex_unlock(&prof_lock);
+	err |= prof_flush(fd, buf, &pos);
+	if(close(fd) != 0)
+		err = -1;
+	return err;
+}
+
+/*********************************************************
+ * prof_printf - printf to fd through buf, which holds   *
+ * pos bytes. return -1 if a write fails                 *
+ *********************************************************/
+static int prof_printf(int fd, char *buf, size_t *pos, const char *fmt, ...){
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(buf + *pos, 4096 - *pos, fmt, ap);	//no line is near as long
+	va_end(ap);
+	if(n < 0)
+		return -1;
+	if((size_t)n >= 4096 - *pos){	//did not fit: again in an empty buffer
+		if(prof_flush(fd, buf, pos) != 0)
+			return -1;
+		va_start(ap, fmt);
+		n = vsnprintf(buf, 4096, fmt, ap);
+		va_end(ap);
+	}
+	*pos += MIN((size_t)n, 4095 - *pos);
+	return 0;
+}
+
+/*********************************************************
+ * prof_flush - write the pos bytes in buf to fd         *
+ *********************************************************/
+static int prof_flush(int fd, char *buf, size_t *pos){
+	size_t done = 0;
+	ssize_t n;
+
+	while(done < *pos){
+		if((n = write(fd, buf + done, *pos - done)) <= 0)
+			return -1;
+		done += n;
+	}
+	*pos = 0;
+	return 0;
+}
+
+/******************************************************************************************************
+ *                                           Library Build                                            *
+ * Without DRIVER the file builds on its own into a library that takes the place of the allocator of  *
+ * the C library, for LD_PRELOAD or to link against:                                                  *
+ *	gcc -O2 -fPIC -shared -fno-builtin-malloc -fno-semantic-interposition                         *
+ *		-ftls-model=initial-exec -I. "malloc V4.c" -o libmm.so -lpthread                      *
+ *	LD_PRELOAD=./libmm.so program                                                                 *
+ * malloc, free, realloc, calloc and the functions of mm_ext.h then keep their libc names and their   *
+ * libc behaviour: the library is always built with MM_WIDE_WORDS, so every block is 16-byte aligned  *
+ * (alignof(max_align_t) on x86-64), malloc(0) returns a block of its own and every failure sets      *
+ * errno to ENOMEM. There is no memlib: the main arena reserves ARENA_SIZE bytes of its own on its    *
+ * first malloc, like any other arena, so nothing has to run before main and calls made by the        *
+ * dynamic loader or by constructors of other libraries are served as well. Large blocks are mapped   *
+ * from 128 KiB on, and DEBUG is left out, so nothing is ever printed but by the heap checker.        *
+ * Only the functions of libc and of mm_ext.h are exported: mm_init, mm_checkheap and the other       *
+ * functions of the lab's interface are INTERNAL, hidden from the program.                            *
+ * -fno-builtin-malloc keeps gcc from turning the malloc and memset of calloc into a call to calloc,  *
+ * which is this calloc again. The initial-exec TLS model keeps the thread locals at a fixed offset,  *
+ * without a call to __tls_get_addr (which may malloc) the first time a thread gets to them.          *
+ * fork copies only the calling thread, so a lock held by any other is held for good in the child.    *
+ * fork_prepare takes every lock of the allocator before the fork (arenas_lock, the arenas in order,  *
+ * then prof_lock, the order in which they nest elsewhere), the parent lets them go after it and the  *
+ * child makes them new. The locks of heap handles and persistent heaps are left to their owners. The *
+ * child also takes the other threads off the list mm_stats walks and keeps their calls in            *
+ * tstats_exited: their stacks, thread locals and all, go to the threads the child creates next.      *
+ ******************************************************************************************************/
+#ifndef DRIVER
+/*********************************************************
+ * fork_prepare, fork_parent, fork_child - the handlers  *
+ * of pthread_atfork, see above                          *
+ *********************************************************/
+static void fork_prepare(void){
+	unsigned int i;
+
+	pthread_mutex_lock(&arenas_lock);
+	for(i = 0; i < narenas; i++)
+		pthread_mutex_lock(&arenas[i]->lock);
+	pthread_mutex_lock(&prof_lock);
+}
+
+static void fork_parent(void){
+	unsigned int i;
+
+	pthread_mutex_unlock(&prof_lock);
+	for(i = narenas; i-- > 0; )
+		pthread_mutex_unlock(&arenas[i]->lock);
+	pthread_mutex_unlock(&arenas_lock);
+}
+
+static void fork_child(void){
+	unsigned int i;
+	tstats_t *t;
+
+	//the other threads are gone, only their calls stay (see above)
+	for(t = tstats_list; t != NULL; t = t->next)
+		if(t != &tstats)
+			tstats_add(&tstats_exited, t);
+	tstats_list = NULL;
+	if(thread_arena != NULL){
+		tstats.next = tstats.prev = NULL;
+		tstats_list = &tstats;
+	}
+
+	pthread_mutex_init(&prof_lock, NULL);
+	for(i = 0; i < narenas; i++)
+		pthread_mutex_init(&arenas[i]->lock, NULL);
+	pthread_mutex_init(&arenas_lock, NULL);
+}
+
+/*********************************************************
+ * fork_init - install the handlers when the library is  *
+ * loaded. Not on the first malloc: pthread_atfork may   *
+ * malloc itself                                         *
+ *********************************************************/
+static __attribute__((constructor)) void fork_init(void){
+	pthread_atfork(fork_prepare, fork_parent, fork_child);
+}
+#endif
+
+/*********************************************************
+ * Return whether the pointer is in the heap.            *
+ * May be useful for debugging.                          *
+ *********************************************************/
+static int in_heap(const void *p) {
+    return (char *)p < arena->brk && (char *)p >= arena->lo;
+}
+
+/*********************************************************
+ * Return whether the pointer is aligned.                *
+ * May be useful for debugging.                          *
+ *********************************************************/
+static int aligned(const void *p) {
+    return (size_t)ALIGN(p) == (size_t)p;
+}
+
+/******************************************************************************************************
+ *                                    Heap Checker with Helpers                                       *
+ * arena_validate checks the whole heap of an arena without a word of output: every block on its own  *
+ * (check_block, which covers its links with check_links), then the order of the BST and that the     *
+ * tree, the chains and min_listp (or the bins of MM_TLSF) hold every free block exactly once. The    *
+ * sampled mode runs check_block over the next check_blocks blocks of an arena every check_every      *
+ * operations on it, wrapping around at the epilogue, so a whole heap gets looked at now and then at  *
+ * a bounded cost.                                                                                    *
+ ******************************************************************************************************/
+/*********************************************************
+ * mm_validate, mm_set_check - see mm_ext.h              *
+ *********************************************************/
+int mm_validate(void **where){
+	unsigned int i, n = __atomic_load_n(&narenas, __ATOMIC_ACQUIRE);
+	int err = MM_CHECK_OK;
+
+	for(i = 0; i < n && err == MM_CHECK_OK; i++){
+		arena_lock(arenas[i]);
+		if(arena->heap_listp != NULL)
+			err = arena_validate(where);
+		arena_unlock();
+	}
+	return err;
+}
+
+void mm_set_check(unsigned int every, unsigned int blocks, void (*fail)(int err, void *bp)){
+	__atomic_store_n(&check_fail, fail, __ATOMIC_RELAXED);
+	__atomic_store_n(&check_blocks, blocks, __ATOMIC_RELAXED);
+	__atomic_store_n(&check_every, (blocks != 0)? every : 0, __ATOMIC_RELAXED);
+}
+
+/*********************************************************
+ * arena_validate - check the whole heap of the current  *
+ * arena, return MM_CHECK_OK or the first error found    *
+ * and (if where is not NULL) the block it was found at  *
+ *********************************************************/
+static int arena_validate(void **where){
+	size_t heap_blocks = 0, heap_bytes = 0, list_blocks = 0, list_bytes = 0;
+	char *bp = arena->heap_listp;
+	void *mp;
+	int err = MM_CHECK_OK;
+
+	//prologue, then every block up to the epilogue
+	if(GET(HDRP(bp)) != PACK(DSIZE, 1, 1) || GET(FTRP(bp)) != PACK(DSIZE, 1, 1))
+		err = MM_CHECK_BOUNDS;
+	for(bp = NEXT_BLKP(bp); err == MM_CHECK_OK && bp != arena->brk; bp = NEXT_BLKP(bp)){
+		if((err = check_block(bp)) != MM_CHECK_OK)
+			break;
+		if(!GET_ALLOC(HDRP(bp))){
+			heap_blocks++;
+			heap_bytes += GET_SIZE(HDRP(bp));
+		}
+	}
+	if(err == MM_CHECK_OK && GET(HDRP(bp)) != PACK(0, 1, GET_PREV_ALLOC(HDRP(bp))))
+		err = MM_CHECK_BOUNDS;
+	if(err != MM_CHECK_OK){
+		if(where != NULL)
+			*where = bp;
+		return err;
+	}
+
+	//every free block is in the BST or min_listp, once
+#ifdef MM_TLSF
+	mp = NULL;
+	if((err = tlsf_check(heap_blocks, &list_blocks, &list_bytes, &mp)) != MM_CHECK_OK)
+		bp = mp;
+#else
+	bp = arena->free_listp;
+	if(bp != NULL)
+		err = check_tree(P2O(bp), 0, (size_t)-1, &list_blocks, &list_bytes);
+	for(mp = arena->min_listp; err == MM_CHECK_OK && mp != NULL; mp = GET_NCO(mp)? O2P(GET_NCO(mp)) : NULL){
+		bp = mp;
+		if(link_block(P2O(mp)) != mp || GET_SIZE(HDRP(mp)) != QSIZE || ++list_blocks > heap_blocks)
+			err = MM_CHECK_LINKS;	//the last one: a cycle
+		list_bytes += QSIZE;
+	}
+#endif
+	if(err == MM_CHECK_OK && (list_blocks != heap_blocks || list_bytes != heap_bytes
+			|| arena->free_blocks != heap_blocks || arena->free_bytes != heap_bytes))
+		err = MM_CHECK_COUNT;
+
+	//the quick lists hold allocated blocks of their size, as many as they count
+	size_t i, quick_blocks = 0, quick_bytes = 0, n;
+	for(i = 0; err == MM_CHECK_OK && i < QUICK_LISTS; i++){
+		n = 0;
+		for(mp = arena->quick[i]; err == MM_CHECK_OK && mp != NULL; mp = *(void **)mp){
+			bp = mp;
+			if(!aligned(mp) || !in_heap(mp) || !GET_ALLOC(HDRP(mp)) || GET_SIZE(HDRP(mp)) != i * DSIZE
+					|| ++n > arena->quick_count[i])	//the last one: a cycle
+				err = MM_CHECK_LINKS;
+		}
+		if(err == MM_CHECK_OK && n != arena->quick_count[i])
+			err = MM_CHECK_COUNT;
+		quick_blocks += n;
+		quick_bytes += n * i * DSIZE;
+	}
+	if(err == MM_CHECK_OK && (arena->quick_blocks != quick_blocks || arena->quick_bytes != quick_bytes))
+		err = MM_CHECK_COUNT;
+#ifdef MM_SIZE_INDEX
+	if(err == MM_CHECK_OK){
+		mp = NULL;
+		if((err = idx_validate(&mp)) != MM_CHECK_OK)
+			bp = mp;
+	}
+#endif
+	if(err != MM_CHECK_OK && where != NULL)
+		*where = bp;
+	return err;
+}
+
+/*********************************************************
+ * check_block - check block bp and the prev-alloc bit   *
+ * of the block after it                                 *
+ *********************************************************/
+static int check_block(void *bp){
+	size_t size = GET_SIZE(HDRP(bp));
+
+	if(!aligned(bp))
+		return MM_CHECK_ALIGN;
+	if(!in_heap(bp) || size < QSIZE || size % DSIZE != 0 || size > (size_t)(arena->brk - (char *)bp))
+		return MM_CHECK_BOUNDS;
+	if(GET_PREV_ALLOC(HDRP(NEXT_BLKP(bp))) != GET_ALLOC(HDRP(bp)))
+		return MM_CHECK_PREV_ALLOC;
+	if(GET_ALLOC(HDRP(bp)))
+		return MM_CHECK_OK;
+
+	if(GET(FTRP(bp)) != GET(HDRP(bp)))
+		return MM_CHECK_FOOTER;
+#ifdef MM_SCALED_OFFSETS	//unless the two are too large to merge
+	if(!GET_PREV_ALLOC(HDRP(bp)) && GET_SIZE((char *)bp - DSIZE) + size <= BLOCK_MAX)
+#else
+	if(!GET_PREV_ALLOC(HDRP(bp)))
+#endif
+		return MM_CHECK_ADJACENT;
+	return check_links(bp);
+}
+
+/*********************************************************
+ * check_links - check the links of free block bp: its   *
+ * chain neighbours point back and have its size, a tree *
+ * node's children are ordered and its height is right   *
+ *********************************************************/
+static int check_links(void *bp){
+	size_t size = GET_SIZE(HDRP(bp));
+	void *p, *l = NULL, *r = NULL;
+
+#ifdef MM_TLSF
+	//a bin member: its neighbours are in the same bin and point back, the first of a bin has no prev
+	if(GET_NCO(bp) != 0 && ((p = link_block(GET_NCO(bp))) == NULL || GET_PCO(p) != P2O(bp)))
+		return MM_CHECK_LINKS;
+	if(GET_NCO(bp) != 0 && tlsf_bin(GET_SIZE(HDRP(p))) != tlsf_bin(size))
+		return MM_CHECK_ORDER;
+	if(GET_PCO(bp) == 0)
+		return (arena->tlsf_bins[tlsf_bin(size)] == bp)? MM_CHECK_OK : MM_CHECK_LINKS;
+	if((p = link_block(GET_PCO(bp))) == NULL || GET_NCO(p) != P2O(bp))
+		return MM_CHECK_LINKS;
+	return MM_CHECK_OK;
+#endif
+
+	if(GET_NCO(bp) != 0 && ((p = link_block(GET_NCO(bp))) == NULL || GET_SIZE(HDRP(p)) != size
+			|| IS_TREE_NODE(p) || GET_PCO(p) != P2O(bp)))
+		return MM_CHECK_LINKS;
+
+	//a chain member: its predecessor points to it, the head of min_listp has none
+	if(size == QSIZE && IS_TREE_NODE(bp))
+		return MM_CHECK_LINKS;
+	if(!IS_TREE_NODE(bp)){
+		if(GET_PCO(bp) == 0)
+			return (size == QSIZE && arena->min_listp == bp)? MM_CHECK_OK : MM_CHECK_LINKS;
+		if((p = link_block(GET_PCO(bp))) == NULL || GET_NCO(p) != P2O(bp))
+			return MM_CHECK_LINKS;
+		return MM_CHECK_OK;
+	}
+
+	//a tree node
+	if((GET_LCO(bp) != 0 && ((l = link_block(GET_LCO(bp))) == NULL || !IS_TREE_NODE(l)))
+			|| (GET_RCO(bp) != 0 && ((r = link_block(GET_RCO(bp))) == NULL || !IS_TREE_NODE(r))))
+		return MM_CHECK_LINKS;
+	if((l != NULL && GET_SIZE(HDRP(l)) >= size) || (r != NULL && GET_SIZE(HDRP(r)) <= size))
+		return MM_CHECK_ORDER;
+	word_t hl = HEIGHT(GET_LCO(bp)), hr = HEIGHT(GET_RCO(bp));
+	if(hl > hr + 1 || hr > hl + 1 || TAG_HEIGHT(GET_PCO(bp)) != MAX(hl, hr) + 1)
+		return MM_CHECK_BALANCE;
+	return MM_CHECK_OK;
+}
+
+#ifndef MM_TLSF
+/*********************************************************
+ * check_tree - check that the sizes of the subtree at   *
+ * root lie strictly between lo and hi, count its blocks *
+ * and their bytes, chains included                      *
+ *********************************************************/
+static int check_tree(word_t root, size_t lo, size_t hi, size_t *blocks, size_t *bytes){
+	void *bp = link_block(root);
+	size_t size;
+	word_t offset;
+	int err;
+
+	if(bp == NULL || GET_ALLOC(HDRP(bp)) || !IS_TREE_NODE(bp))
+		return MM_CHECK_LINKS;
+	size = GET_SIZE(HDRP(bp));
+	if(size <= lo || size >= hi)
+		return MM_CHECK_ORDER;
+	for(offset = root; offset != 0; offset = GET_NCO(O2P(offset))){	//the heap walk ruled out cycles
+		(*blocks)++;
+		*bytes += size;
+	}
+	if(GET_LCO(bp) != 0 && (err = check_tree(GET_LCO(bp), lo, size, blocks, bytes)) != MM_CHECK_OK)
+		return err;
+	if(GET_RCO(bp) != 0 && (err = check_tree(GET_RCO(bp), size, hi, blocks, bytes)) != MM_CHECK_OK)
+		return err;
+	return MM_CHECK_OK;
+}
+#endif
+
+#ifdef MM_TLSF
+/*********************************************************
+ * tlsf_check - check that the bins and their bitmaps    *
+ * agree and that every block is in its bin, count the   *
+ * blocks and their bytes                                *
+ *********************************************************/
+static int tlsf_check(size_t heap_blocks, size_t *blocks, size_t *bytes, void **where){
+	unsigned int bin;
+	word_t prev;
+	void *bp;
+
+	for(bin = 0; bin < TLSF_FL * TLSF_SL; bin++){
+		if(((arena->tlsf_sl_map[bin / TLSF_SL] >> (bin % TLSF_SL)) & 1) != (arena->tlsf_bins[bin] != NULL)
+				|| ((arena->tlsf_fl_map >> (bin / TLSF_SL)) & 1) != (arena->tlsf_sl_map[bin / TLSF_SL] != 0))
+			return MM_CHECK_LINKS;
+		prev = 0;
+		for(bp = arena->tlsf_bins[bin]; bp != NULL; bp = GET_NCO(bp)? O2P(GET_NCO(bp)) : NULL){
+			*where = bp;
+			if(link_block(P2O(bp)) != bp || GET_PCO(bp) != prev || ++*blocks > heap_blocks)
+				return MM_CHECK_LINKS;	//the last one: a cycle
+			if(tlsf_bin(GET_SIZE(HDRP(bp))) != bin)
+				return MM_CHECK_ORDER;
+			*bytes += GET_SIZE(HDRP(bp));
+			prev = P2O(bp);
+		}
+	}
+	return MM_CHECK_OK;
+}
+#endif
+
+/*********************************************************
+ * link_block - the block at offset of the current arena,*
+ * NULL if no free block can start there                 *
+ *********************************************************/
+static void *link_block(word_t offset){
+	char *bp = O2P(offset);
+
+	if(offset == 0 || !aligned(bp) || bp < (char *)arena->heap_listp + DSIZE || bp + QSIZE > arena->brk)
+		return NULL;
+	if(GET_ALLOC(HDRP(bp)) || GET_SIZE(HDRP(bp)) < QSIZE || GET_SIZE(HDRP(bp)) > (size_t)(arena->brk - bp))
+		return NULL;
+	return bp;
+}
+
+#ifdef MM_SIZE_INDEX
+/*********************************************************
+ * idx_validate - check that the size index of the       *
+ * current arena is in order and holds every tree node   *
+ * once, after the tree itself checked out               *
+ *********************************************************/
+static int idx_validate(void **where){
+	unsigned int j, k, id;
+	size_t entries = 0;
+	word_t last = 0;
+	idx_bucket_t *b;
+
+	if(arena->idx_off)	//not kept
+		return MM_CHECK_OK;
+	for(j = 0; j < arena->idx_buckets; j++){
+		if((id = arena->idx_map[j]) >= arena->idx_unused)
+			return MM_CHECK_LINKS;
+		b = &arena->idx_pool[id];
+		if(b->size[0] == IDX_NONE || arena->idx_first[j] != b->size[0])
+			return MM_CHECK_ORDER;
+		for(k = 0; k < IDX_B && b->size[k] != IDX_NONE; k++){
+			void *bp = link_block(b->node[k]), *rp = arena->free_listp;
+			if(b->size[k] <= last)
+				return MM_CHECK_ORDER;
+			last = b->size[k];
+			if(bp != NULL)
+				*where = bp;
+			while(rp != NULL && GET_SIZE(HDRP(rp)) != last)	//the node the tree has for the size
+				rp = (last < GET_SIZE(HDRP(rp)))? (GET_LCO(rp)? O2P(GET_LCO(rp)) : NULL) : (GET_RCO(rp)? O2P(GET_RCO(rp)) : NULL);
+			if(bp == NULL || bp != rp)
+				return MM_CHECK_LINKS;
+			entries++;
+		}
+		for(; k < IDX_B; k++)
+			if(b->size[k] != IDX_NONE)
+				return MM_CHECK_ORDER;
+	}
+	if(entries != ((arena->free_listp == NULL)? 0 : count_nodes(P2O(arena->free_listp))))
+		return MM_CHECK_COUNT;
+	return MM_CHECK_OK;
+}
+
+/*********************************************************
+ * count_nodes - the nodes of the subtree at root        *
+ *********************************************************/
+static size_t count_nodes(word_t root){
+	if(root == 0)
+		return 0;
+	return 1 + count_nodes(GET_LCO(O2P(root))) + count_nodes(GET_RCO(O2P(root)));
+}
+#endif
+
+/*********************************************************
+ * check_tick - count an operation on the current arena, *
+ * check the next slice of its heap when it is time      *
+ *********************************************************/
+static void check_tick(void){
+	unsigned int i, n = __atomic_load_n(&check_blocks, __ATOMIC_RELAXED);
+	char *bp = arena->check_at;
+	void (*fail)(int err, void *bp);
+	int err = MM_CHECK_OK;
+
+	if(++arena->checks < __atomic_load_n(&check_every, __ATOMIC_RELAXED))
+		return;
+	arena->checks = 0;
+	for(i = 0; i < n; i++){
+		if(bp == NULL || bp >= arena->brk){	//start over
+			bp = NEXT_BLKP(arena->heap_listp);
+			if(bp >= arena->brk)	//no block at all
+				break;
+		}
+		if((err = check_block(bp)) != MM_CHECK_OK)
+			break;
+		bp = NEXT_BLKP(bp);
+	}
+	arena->check_at = bp;
+	if(err == MM_CHECK_OK)
+		return;
+	arena->check_at = NULL;
+	if((fail = __atomic_load_n(&check_fail, __ATOMIC_RELAXED)) == NULL)
+		abort();
+	fail(err, bp);
+}
+
+/*********************************************************
+ * mm_checkheap - validate the heap the calling thread   *
+ * worked on last, print the result, every block and the *
+ * BST                                                   *
+ *********************************************************/
+void mm_checkheap_traverse(void *bp){
+	if(bp == NULL)
+		return;
+	if(GET_LCO(bp))
+		mm_checkheap_traverse(O2P(GET_LCO(bp)));
+	printf("BST INFO: bp = %lx, size = %u, height = %u\n", (unsigned long)bp,
+		(unsigned)GET_SIZE(HDRP(bp)), (unsigned)TAG_HEIGHT(GET_PCO(bp)));
+	mm_checkheap_chain(GET_NCO(bp));
+	if(GET_RCO(bp))
+		mm_checkheap_traverse(O2P(GET_RCO(bp)));
+	return;
+}
+
+void mm_checkheap_chain(word_t offset){
+	while(offset != 0){
+		printf("	CHAIN INFO: bp = %lx\n", (unsigned long)O2P(offset));
+		offset = GET_NCO(O2P(offset));
+	}
+}
+
+void mm_checkheap(int lineno){
+	void *where = NULL;
+	int err;
+
+	//the arena this thread worked on last
+	if(arena == NULL)
+		arena = (thread_arena != NULL)? thread_arena : &main_arena;
+
+	err = arena_validate(&where);
+	printf("checkheap called from line %d: error %d at %lx\n", lineno, err, (unsigned long)where);
+
+	//block check, iterate through implicitly
+	void *bp = arena->heap_listp;
+	while(1){
+		int size = GET_SIZE(HDRP(bp));
+		int alloc = GET_ALLOC(HDRP(bp));
+		int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+		printf("BLOCK INFO: bp = %lx, size = %u, alloc = %u, prev_alloc = %u\n", 
+			(unsigned long)bp, (unsigned)size, alloc, prev_alloc);
+		if(!alloc){
+			printf("	nco = %u, pco = %u\n", (unsigned)GET_NCO(bp), (unsigned)GET_PCO(bp));
+			if(size > QSIZE)
+				printf("	lco = %u, rco = %u\n", (unsigned)GET_LCO(bp), (unsigned)GET_RCO(bp));
+		}
+		if(size == 0 || (char *)bp >= arena->brk)	//epilogue
+			break;
+		bp = NEXT_BLKP(bp);
+	}
+
+#ifdef MM_TLSF
+	//bins check
+	unsigned int bin;
+	for(bin = 0; bin < TLSF_FL * TLSF_SL; bin++)
+		if(arena->tlsf_bins[bin] != NULL){
+			printf("BIN INFO: fl = %u, sl = %u\n", bin / TLSF_SL, bin % TLSF_SL);
+			mm_checkheap_chain(P2O(arena->tlsf_bins[bin]));
+		}
+#else
+	//BST check
+	printf("BST INFO: free_listp = %lx\n", (unsigned long)arena->free_listp);
+	mm_checkheap_traverse(arena->free_listp);
+	printf("BST INFO: min_listp = %lx\n", (unsigned long)arena->min_listp);
+	if(arena->min_listp != NULL)
+		mm_checkheap_chain(P2O(arena->min_listp));
+#endif
  
 	printf("\n\n");
 	//char c;
@@ -675,7 +4810,7 @@ void mm_checkheap(int lineno){
 void exit_from_error(){
 	printf("Press any key to exit.\n");
 	mm_checkheap(646);
-	exit(0);
+	abort();	//not exit(0): a corrupted heap is not a clean exit
 }
 
 /******************************************************************************************************
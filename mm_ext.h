@@ -0,0 +1,209 @@
+/******************************************************************************************************
+ * Extensions to the mm.h interface of the allocator in "malloc V4.c"                                 *
+ ******************************************************************************************************/
+#ifndef MM_EXT_H
+#define MM_EXT_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Requests of at least bytes bytes get a mapping of their own instead of a heap block.
+ * Setting it turns off the adaptive threshold; 0 restores the adaptive default. */
+void mm_set_mmap_threshold(size_t bytes);
+
+/* Give free memory back to the system: cut the heap of every arena back to pad bytes above its last
+ * allocated block and release the pages inside all free blocks. Returns 1 if anything was released. */
+int mm_trim(size_t pad);
+
+/* Policy for doing the same on the fly. A free block of more than bytes bytes at the top of a heap is
+ * trimmed down to the top pad (defaults 128 KiB and 64 KiB, 0 turns automatic trimming off). Every ms
+ * milliseconds (default 1000, 0 turns it off) an arena releases the pages of its large free blocks.
+ * Built with -DMM_HUGE_PAGES the defaults are 4 MiB and 2 MiB, and both release whole 2 MiB pages. */
+void mm_set_trim_threshold(size_t bytes);
+void mm_set_top_pad(size_t bytes);
+void mm_set_decay(unsigned int ms);
+
+/* A heap that runs out of room grows by an eighth of its size, at least 512 bytes and at most the
+ * cap (default 16 MiB, 0 restores it), and by less for a while after it has been trimmed. */
+void mm_set_grow_cap(size_t bytes);
+
+/* Growth counters, summed over all arenas since they were initialized */
+typedef struct{
+	size_t sbrk_calls;	//times a heap grew
+	size_t heap_bytes;	//current size of the heaps
+	size_t untouched_bytes;	//at the top of the heaps, never handed out
+} mm_growth_t;
+void mm_get_growth(mm_growth_t *g);
+
+/* Statistics, always kept. Heap counters are summed over all arenas since they were initialized,
+ * calls over all threads since mm_init. Calls are counted by the size asked for, in classes of their
+ * own for the small object sizes (8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224,
+ * 256; built with -DMM_WIDE_WORDS the multiples of 16 up to 256), then class 16 + k for
+ * [256 << k, 512 << k), the last class taking everything larger.
+ * calloc counts as malloc; a realloc that moves the block also counts a malloc and a free. */
+#define MM_STAT_CLASSES	48
+#define MM_STAT_DEPTHS	32	//the last bucket of fit_depth takes the deeper searches
+typedef struct{
+	size_t heap_bytes;	//current size of the heaps
+	size_t in_use_bytes;	//heap bytes not free or on quick lists (headers and slabs included), plus mmapped_bytes
+	size_t free_bytes;	//in free blocks
+	size_t free_blocks;
+	size_t quick_bytes;	//in freed blocks on the quick lists, not yet coalesced
+	size_t quick_blocks;
+	size_t quick_flushes;	//times a quick list was coalesced into the free blocks
+	size_t mmapped_bytes;	//in mappings of large objects
+	size_t untouched_bytes;	//at the top of the heaps, never handed out
+	size_t sbrk_calls;	//times a heap grew
+	size_t splits;	//free blocks split to place a block
+	size_t coalesce[4];	//frees by neighbours: [0] none free, [1] next, [2] previous, [3] both
+	size_t fit_misses;	//searches of the free blocks that found none large enough
+	size_t fit_depth[MM_STAT_DEPTHS];	//searches of the tree of free blocks by the nodes they visited (1 with MM_SIZE_INDEX)
+	size_t malloc_calls[MM_STAT_CLASSES];
+	size_t free_calls[MM_STAT_CLASSES];
+	size_t realloc_calls[MM_STAT_CLASSES];
+} mm_stats_t;
+void mm_stats(mm_stats_t *st);
+
+/* One statistic by the name of its field in mm_stats_t, "coalesce.1" for one element of an array
+ * or just "coalesce" for their sum. Returns 0, or -1 if there is no such statistic. */
+int mm_stat(const char *name, size_t *value);
+
+/* All of mm_stats_t as one JSON object. Like snprintf: returns the length of the whole object and
+ * writes as much of it as fits in len bytes. */
+int mm_stats_json(char *buf, size_t len);
+
+/* Integrity checks. mm_validate checks every block of every arena: alignment, bounds, that header and
+ * footer of a free block agree, the prev-alloc bits, that no two free blocks are adjacent, the order
+ * and balance of the tree of free blocks, that it holds every free block exactly once and that the
+ * quick lists hold as many allocated blocks of their size as they count. It prints nothing and
+ * returns MM_CHECK_OK or the first error found, with the block (if where is not NULL). */
+#define MM_CHECK_OK	0
+#define MM_CHECK_ALIGN	1	//a block is not aligned
+#define MM_CHECK_BOUNDS	2	//a block (or the prologue or epilogue) has a size that does not fit the heap
+#define MM_CHECK_FOOTER	3	//header and footer of a free block differ
+#define MM_CHECK_PREV_ALLOC	4	//the prev-alloc bit of the block after this one is wrong
+#define MM_CHECK_ADJACENT	5	//two free blocks next to each other
+#define MM_CHECK_LINKS	6	//a link of a free block does not lead to a free block that links back
+#define MM_CHECK_ORDER	7	//the tree of free blocks is out of order
+#define MM_CHECK_BALANCE	8	//a height in the tree of free blocks is wrong
+#define MM_CHECK_COUNT	9	//the free blocks in the heap and those in the tree differ
+int mm_validate(void **where);
+
+/* Sampled checks: every every operations on an arena, check its next blocks blocks on their own (all
+ * of the above but the tree order and count), wrapping around at the end of the heap. On an error
+ * fail is called with the arena locked, it must not call the allocator; NULL aborts. Off by default,
+ * every or blocks 0 turns it off. */
+void mm_set_check(unsigned int every, unsigned int blocks, void (*fail)(int err, void *bp));
+
+/* Deferred coalescing. A freed heap block of at most 1 KiB goes on a quick list of its exact size,
+ * unmerged, for the next malloc of that size. A list is coalesced into the free blocks when it holds
+ * len blocks (default 32, at most 65535), and all of them when a search for a fit fails or the heap
+ * is about to grow. 0 turns the lists off; blocks already on them stay until the next such flush. */
+void mm_set_quick(unsigned int len);
+
+/* Aligned allocation, as in libc (built with -DDRIVER they are named mm_posix_memalign and so on).
+ * The alignment must be a power of two, and for posix_memalign a multiple of sizeof(void *);
+ * memalign rounds it up to one. valloc aligns to a page, pvalloc rounds the size up to pages as
+ * well. The blocks are freed and resized with free and realloc. */
+int mm_posix_memalign(void **memptr, size_t alignment, size_t size);
+void *mm_aligned_alloc(size_t alignment, size_t size);
+void *mm_memalign(size_t alignment, size_t size);
+void *mm_valloc(size_t size);
+void *mm_pvalloc(size_t size);
+
+/* realloc of nmemb * size bytes that fails with ENOMEM when the product overflows, as in libc (built
+ * with -DDRIVER it is named mm_reallocarray). */
+void *mm_reallocarray(void *ptr, size_t nmemb, size_t size);
+
+/* Batches of blocks. mm_malloc_batch allocates n blocks of size bytes (size 0 taken as 1, as malloc
+ * does) into ptrs and returns how many it got, fewer than n only when memory runs out. mm_free_batch
+ * frees the n blocks in ptrs (NULL is skipped) and leaves ptrs scrambled. Blocks from either may also
+ * go to free or realloc. */
+size_t mm_malloc_batch(size_t size, size_t n, void **ptrs);
+void mm_free_batch(void **ptrs, size_t n);
+
+/* Sized free: size must be the size ptr was allocated with (by malloc, calloc, memalign and the like,
+ * or the last realloc of it). Saves free the look at the slab of a small object. malloc_usable_size
+ * tells how many bytes of ptr may be used, at least its size; they stay usable until ptr is freed or
+ * passed to realloc. Built with -DDRIVER they are named mm_free_sized and
+ * mm_malloc_usable_size. */
+void mm_free_sized(void *ptr, size_t size);
+size_t mm_malloc_usable_size(void *ptr);
+
+/* Persistent heaps. mm_pheap_open maps the heap in the file at path, creating it with room for size
+ * bytes (rounded up to pages, the file is sparse) if it does not exist; size is ignored otherwise.
+ * The heap holds offsets, not pointers, so the next process to open the file may map it at another
+ * address and finds every block in place. Pointers the application keeps in the heap must be offsets
+ * from mm_pheap_base too; the root object (NULL: none) is how it finds its data again. Blocks of a
+ * persistent heap come from mm_pheap_malloc (size 0 taken as 1, as malloc does) and go back to
+ * mm_pheap_free only, never to free or realloc. mm_pheap_sync writes the heap to the file,
+ * mm_pheap_close does the same and unmaps it. A heap that was never closed (its process died) is
+ * rebuilt from its blocks on open. Open fails with EWOULDBLOCK if another process has the heap open,
+ * EINVAL if the file is not a heap of this build, and EIO if its blocks do not check out. */
+typedef struct mm_pheap mm_pheap_t;
+mm_pheap_t *mm_pheap_open(const char *path, size_t size);
+int mm_pheap_sync(mm_pheap_t *h);
+int mm_pheap_close(mm_pheap_t *h);
+void *mm_pheap_malloc(mm_pheap_t *h, size_t size);
+void mm_pheap_free(mm_pheap_t *h, void *ptr);
+void *mm_pheap_base(mm_pheap_t *h);
+void *mm_pheap_root(mm_pheap_t *h);
+void mm_pheap_set_root(mm_pheap_t *h, void *ptr);
+
+/* Heap handles: heaps of their own, apart from the one behind malloc, each in memory of its own so
+ * that no two heaps share a cache line. Blocks of a heap come from mm_heap_malloc (size 0 taken as 1,
+ * as malloc does) and mm_heap_realloc and go back to mm_heap_free or mm_heap_realloc of the same heap
+ * only, never to free or realloc. mm_heap_reset frees every block of the heap at once, in a time that
+ * does not depend on their number, and keeps its memory for what comes next; mm_heap_destroy unmaps
+ * it. A heap may be used by several threads, which take turns. */
+typedef struct mm_heap mm_heap_t;
+mm_heap_t *mm_heap_create(void);
+void mm_heap_destroy(mm_heap_t *h);
+void mm_heap_reset(mm_heap_t *h);
+void *mm_heap_malloc(mm_heap_t *h, size_t size);
+void mm_heap_free(mm_heap_t *h, void *ptr);
+void *mm_heap_realloc(mm_heap_t *h, void *ptr, size_t size);
+
+/* Aligned blocks of a heap, the alignment a power of two; they go back to mm_heap_free too. A heap
+ * grows by an eighth of its size like the others, or by bytes at a time after mm_heap_set_grow_step
+ * (0 restores the default); the step outlives mm_heap_reset. */
+void *mm_heap_memalign(mm_heap_t *h, size_t alignment, size_t size);
+void mm_heap_set_grow_step(mm_heap_t *h, size_t bytes);
+
+/* Sampling heap profiler, off by default. mm_set_profile(bytes) samples about one allocation in every
+ * bytes bytes asked for from malloc, calloc, realloc and the aligned functions (heaps and batches are
+ * not sampled) and keeps the stack it was made from until the block is freed; 0 turns it off and
+ * forgets the samples. Other threads notice a change within 16 MiB of their allocations. A sampled
+ * block is never a small object, so bytes should stay well above 256 (512 KiB, as tcmalloc, is
+ * cheap). mm_profile_dump writes the live samples and all allocations sampled so far to path as a heap
+ * profile for pprof, with the mappings of the process for its symbols: pprof -sample_index=inuse_space
+ * or alloc_space (and the _objects) give the live heap and the cumulative allocations, scaled up from
+ * the samples. Returns 0, or -1 if the file cannot be written. */
+void mm_set_profile(size_t bytes);
+int mm_profile_dump(const char *path);
+
+/* Lifetimes from the same samples. mm_profile_lifetimes writes to path a line per stack,
+ *	freed: mean lifetime [live: mean age] @ pc pc ...
+ * with the sampled blocks from the stack that were freed, how long they lived on average, those that
+ * are still live and how old they are on average. Lifetimes and ages are counted in bytes allocated
+ * by the whole process meanwhile (the first line has the total so far, then the rate), so they do not
+ * depend on the speed of the machine. Returns 0, or -1 if the file cannot be written. */
+int mm_profile_lifetimes(const char *path);
+
+/* Lifetime hints: malloc, told whether the block will be freed soon (MM_SHORT_LIVED) or stay for long
+ * (MM_LONG_LIVED). The two kinds are cut from opposite ends of the free blocks, so the holes the
+ * short-lived blocks leave merge instead of being pinned between long-lived ones; requests of up to
+ * 256 bytes, those that get a mapping and a hint of 0 (or both) are plain malloc. The blocks are
+ * freed and resized with free and realloc as any other. */
+#define MM_SHORT_LIVED	1
+#define MM_LONG_LIVED	2
+void *mm_malloc_hint(size_t size, int hint);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MM_EXT_H */
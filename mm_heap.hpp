@@ -0,0 +1,246 @@
+/******************************************************************************************************
+ * C++ interface to the heap handles of mm_ext.h: a heap whose fit, alignment and growth are template *
+ * parameters, an allocator for the standard containers on top of it and a std::pmr::memory_resource.*
+ * Header only, C++17; "malloc V4.c" is compiled as C and linked as usual.                            *
+ *                                                                                                    *
+ *	mm::Heap<mm::SizeClassFit> heap;                                                              *
+ *	std::vector<int, mm::Allocator<int, decltype(heap)>> v{mm::Allocator<int, decltype(heap)>(heap)}; *
+ *	mm::Resource<decltype(heap)> res(heap);                                                       *
+ *	std::pmr::unordered_map<int, int> m(&res);                                                    *
+ *                                                                                                    *
+ * The policies are decided at compile time: a heap that never frees does not call free, one with no *
+ * alignment beyond the natural one never looks at the alignment asked for, and so on.                *
+ ******************************************************************************************************/
+#ifndef MM_HEAP_HPP
+#define MM_HEAP_HPP
+
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "mm_ext.h"
+
+namespace mm{
+
+namespace detail{
+constexpr std::size_t natural_alignment = 8;	//of every block, in every word mode
+
+constexpr bool is_pow2(std::size_t n){
+	return n != 0 && (n & (n - 1)) == 0;
+}
+
+constexpr std::size_t log2(std::size_t n){	//rounded down
+	std::size_t k = 0;
+
+	while(n >>= 1)
+		k++;
+	return k;
+}
+
+constexpr std::size_t align_up(std::size_t n, std::size_t align){
+	return (n + align - 1) & ~(align - 1);
+}
+}
+
+/******************************************************************************************************
+ * Fit policies: the size of the block a request gets, and whether freeing a block does anything.     *
+ ******************************************************************************************************/
+struct BestFit{	//every request as it is, the heap finds the best fit
+	static constexpr bool frees = true;
+	static constexpr std::size_t round(std::size_t n){
+		return n;
+	}
+};
+
+struct SizeClassFit{	//up to one of four sizes to a power of two, so a freed block fits the next request of its class
+	static constexpr bool frees = true;
+	static constexpr std::size_t round(std::size_t n){
+		if(n <= 64)
+			return detail::align_up(n, 8);
+		return detail::align_up(n, std::size_t(1) << (detail::log2(n - 1) - 2));
+	}
+};
+
+struct Monotonic{	//blocks are never freed one by one, only all at once by reset or with the heap
+	static constexpr bool frees = false;
+	static constexpr std::size_t round(std::size_t n){
+		return n;
+	}
+};
+
+/******************************************************************************************************
+ * Growth policies: how much the heap takes from the system when it runs out of room.                 *
+ ******************************************************************************************************/
+struct GeometricGrowth{	//an eighth of its size, up to the cap of mm_set_grow_cap
+	static constexpr std::size_t step = 0;
+};
+
+template<std::size_t Bytes>
+struct ChunkGrowth{	//Bytes at a time
+	static_assert(Bytes != 0, "the step must not be 0");
+	static constexpr std::size_t step = Bytes;
+};
+
+/******************************************************************************************************
+ * Heap: a heap handle with the policies. allocate returns nullptr when there is no memory, the       *
+ * adapters below turn that into std::bad_alloc. Heaps move but do not copy.                          *
+ ******************************************************************************************************/
+template<class FitPolicy = BestFit, std::size_t Alignment = detail::natural_alignment, class GrowthPolicy = GeometricGrowth>
+class Heap{
+	static_assert(detail::is_pow2(Alignment), "the alignment must be a power of two");
+
+public:
+	using fit_policy = FitPolicy;
+	using growth_policy = GrowthPolicy;
+	static constexpr std::size_t alignment = Alignment;
+
+	//the bytes a request of n bytes asks the heap for
+	static constexpr std::size_t block_size(std::size_t n){
+		return FitPolicy::round((n == 0)? 1 : n);
+	}
+
+	Heap() : h(mm_heap_create()){
+		if(h == nullptr)
+			throw std::bad_alloc();
+		if constexpr(GrowthPolicy::step != 0)
+			mm_heap_set_grow_step(h, GrowthPolicy::step);
+	}
+
+	Heap(const Heap &) = delete;
+	Heap &operator=(const Heap &) = delete;
+
+	Heap(Heap &&other) noexcept : h(std::exchange(other.h, nullptr)){}
+
+	Heap &operator=(Heap &&other) noexcept{
+		if(this != &other){
+			if(h != nullptr)
+				mm_heap_destroy(h);
+			h = std::exchange(other.h, nullptr);
+		}
+		return *this;
+	}
+
+	~Heap(){
+		if(h != nullptr)
+			mm_heap_destroy(h);
+	}
+
+	//n bytes aligned to align and to Alignment
+	void *allocate(std::size_t n, std::size_t align = Alignment) noexcept{
+		if constexpr(Alignment <= detail::natural_alignment)
+			if(align <= detail::natural_alignment)
+				return mm_heap_malloc(h, block_size(n));
+		return mm_heap_memalign(h, (align > Alignment)? align : Alignment, block_size(n));
+	}
+
+	void deallocate(void *p, std::size_t n = 0) noexcept{
+		(void)n;
+		if constexpr(FitPolicy::frees)
+			mm_heap_free(h, p);
+	}
+
+	//free every block at once
+	void reset() noexcept{
+		mm_heap_reset(h);
+	}
+
+	mm_heap_t *handle() const noexcept{
+		return h;
+	}
+
+private:
+	mm_heap_t *h;
+};
+
+/******************************************************************************************************
+ * Allocator: for the standard containers, drawing from a heap that outlives them. Two allocators are *
+ * equal when they share the heap, and the heap travels with the containers on copy, move and swap.   *
+ ******************************************************************************************************/
+template<class T, class H = Heap<>>
+class Allocator{
+public:
+	using value_type = T;
+	using propagate_on_container_copy_assignment = std::true_type;
+	using propagate_on_container_move_assignment = std::true_type;
+	using propagate_on_container_swap = std::true_type;
+	using is_always_equal = std::false_type;
+
+	template<class U>
+	struct rebind{
+		using other = Allocator<U, H>;
+	};
+
+	explicit Allocator(H &heap) noexcept : heap(&heap){}
+
+	template<class U>
+	Allocator(const Allocator<U, H> &other) noexcept : heap(other.heap){}
+
+	T *allocate(std::size_t n){
+		if(n > std::size_t(-1) / sizeof(T))
+			throw std::bad_array_new_length();
+		void *p = heap->allocate(n * sizeof(T), alignof(T));
+		if(p == nullptr)
+			throw std::bad_alloc();
+		return static_cast<T *>(p);
+	}
+
+	void deallocate(T *p, std::size_t n) noexcept{
+		heap->deallocate(p, n * sizeof(T));
+	}
+
+	template<class U>
+	bool operator==(const Allocator<U, H> &other) const noexcept{
+		return heap == other.heap;
+	}
+
+	template<class U>
+	bool operator!=(const Allocator<U, H> &other) const noexcept{
+		return heap != other.heap;
+	}
+
+private:
+	template<class, class>
+	friend class Allocator;
+
+	H *heap;
+};
+
+/******************************************************************************************************
+ * Resource: a std::pmr::memory_resource on a heap that outlives it, for std::pmr containers. Two     *
+ * resources are equal when they share the heap.                                                      *
+ ******************************************************************************************************/
+template<class H = Heap<>>
+class Resource : public std::pmr::memory_resource{
+public:
+	explicit Resource(H &heap) noexcept : heap(&heap){}
+
+	H &get_heap() const noexcept{
+		return *heap;
+	}
+
+private:
+	void *do_allocate(std::size_t bytes, std::size_t align) override{
+		void *p = heap->allocate(bytes, align);
+		if(p == nullptr)
+			throw std::bad_alloc();
+		return p;
+	}
+
+	void do_deallocate(void *p, std::size_t bytes, std::size_t align) override{
+		(void)align;
+		heap->deallocate(p, bytes);
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override{
+		const Resource *r = dynamic_cast<const Resource *>(&other);
+		return r != nullptr && r->heap == heap;
+	}
+
+	H *heap;
+};
+
+}
+
+#endif /* MM_HEAP_HPP */